@@ -18,12 +18,13 @@ public:
 		m_Triangle = Hiruki::Graphics::Mesh::empty();
 
 		// Add triangle's vertices
-		m_Triangle->vertices.emplace_back(0, 1, 0);
-		m_Triangle->vertices.emplace_back(-1.25, -1, 0);
-		m_Triangle->vertices.emplace_back(1.25, -1, 0);
+		m_Triangle->vertexStream.push_back(Hiruki::Math::Vector3(0, 1, 0));
+		m_Triangle->vertexStream.push_back(Hiruki::Math::Vector3(-1.25, -1, 0));
+		m_Triangle->vertexStream.push_back(Hiruki::Math::Vector3(1.25, -1, 0));
 
-		// Add triangle's face [Note: Indices start at index 1]
-		m_Triangle->faces.emplace_back(Hiruki::Math::Vector3i(1, 2, 3), 0xFFFFFFFF);
+		// Add triangle's face [Note: Indices start at index 0]
+		m_Triangle->addFace({0, 1, 2});
+		m_Triangle->updateGeometry();
 
 		// Camera starting state
 		m_Camera.setPosition(Hiruki::Math::Vector3(0, 0, -3));
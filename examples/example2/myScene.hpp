@@ -16,6 +16,7 @@ public:
 		// Floor object
 		std::unique_ptr<Hiruki::Graphics::Mesh> floor = Hiruki::Graphics::Mesh::loadFromFile("assets/floor.obj");
 		floor->translation.z = 0;
+		floor->occluder = true;
 
 		// Cop object
 		std::unique_ptr<Hiruki::Graphics::Mesh> cop = Hiruki::Graphics::Mesh::loadFromFile("assets/cop.obj");
@@ -34,6 +35,7 @@ public:
 		// Garage object
 		std::unique_ptr<Hiruki::Graphics::Mesh> garage = Hiruki::Graphics::Mesh::loadFromFile("assets/garage.obj");
 		garage->translation = Hiruki::Math::Vector3(0.970843, 2.37479, 4.69693);
+		garage->occluder = true;
 
 		// Barrier object 1
 		std::unique_ptr<Hiruki::Graphics::Mesh> barrier1 = Hiruki::Graphics::Mesh::loadFromFile("assets/barrier.obj");
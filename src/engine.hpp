@@ -47,6 +47,50 @@ namespace Hiruki {
 				m_RenderPipeline.setWireframeColor(color);
 			}
 
+			inline void setRenderDepthTestEnabled(bool enabled) {
+				m_RenderPipeline.setDepthTestEnabled(enabled);
+			}
+
+			inline void setRenderDepthWriteEnabled(bool enabled) {
+				m_RenderPipeline.setDepthWriteEnabled(enabled);
+			}
+
+			inline void setRenderHiZEnabled(bool enabled) {
+				m_RenderPipeline.setHiZEnabled(enabled);
+			}
+
+			inline void setRenderVisibilityBufferEnabled(bool enabled) {
+				m_RenderPipeline.setVisibilityBufferEnabled(enabled);
+			}
+
+			inline void setRenderGuardBandEnabled(bool enabled) {
+				m_RenderPipeline.setGuardBandEnabled(enabled);
+			}
+
+			inline void setRenderFrustumCullingEnabled(bool enabled) {
+				m_RenderPipeline.setFrustumCullingEnabled(enabled);
+			}
+
+			inline void setRenderBoundingVolumeHierarchyEnabled(bool enabled) {
+				m_RenderPipeline.setBoundingVolumeHierarchyEnabled(enabled);
+			}
+
+			inline void setRenderOcclusionCullingEnabled(bool enabled) {
+				m_RenderPipeline.setOcclusionCullingEnabled(enabled);
+			}
+
+			inline void setRenderClippingMode(Graphics::RenderPipeline::ClippingMode clippingMode) {
+				m_RenderPipeline.setClippingMode(clippingMode);
+			}
+
+			inline void setRenderBinningEnabled(bool enabled) {
+				m_RenderPipeline.setBinningEnabled(enabled);
+			}
+
+			inline void setRenderRasterKernel(Graphics::RenderPipeline::RasterKernel kernel) {
+				m_RenderPipeline.setRasterKernel(kernel);
+			}
+
 			inline Graphics::RenderPipeline::DrawMode getRenderDrawMode() const {
 				return m_RenderPipeline.getDrawMode();
 			}
@@ -63,6 +107,54 @@ namespace Hiruki {
 				return m_RenderPipeline.getWireframeColor();
 			}
 
+			inline bool getRenderDepthTestEnabled() const {
+				return m_RenderPipeline.getDepthTestEnabled();
+			}
+
+			inline bool getRenderDepthWriteEnabled() const {
+				return m_RenderPipeline.getDepthWriteEnabled();
+			}
+
+			inline bool getRenderHiZEnabled() const {
+				return m_RenderPipeline.getHiZEnabled();
+			}
+
+			inline bool getRenderVisibilityBufferEnabled() const {
+				return m_RenderPipeline.getVisibilityBufferEnabled();
+			}
+
+			inline bool getRenderGuardBandEnabled() const {
+				return m_RenderPipeline.getGuardBandEnabled();
+			}
+
+			inline bool getRenderFrustumCullingEnabled() const {
+				return m_RenderPipeline.getFrustumCullingEnabled();
+			}
+
+			inline bool getRenderBoundingVolumeHierarchyEnabled() const {
+				return m_RenderPipeline.getBoundingVolumeHierarchyEnabled();
+			}
+
+			inline bool getRenderOcclusionCullingEnabled() const {
+				return m_RenderPipeline.getOcclusionCullingEnabled();
+			}
+
+			inline Graphics::RenderPipeline::ClippingMode getRenderClippingMode() const {
+				return m_RenderPipeline.getClippingMode();
+			}
+
+			inline bool getRenderBinningEnabled() const {
+				return m_RenderPipeline.getBinningEnabled();
+			}
+
+			inline Graphics::RenderPipeline::RasterKernel getRenderRasterKernel() const {
+				return m_RenderPipeline.getRasterKernel();
+			}
+
+			inline const Graphics::RenderPipeline::Stats &getRenderStats() const {
+				return m_RenderPipeline.getStats();
+			}
+
 			inline void setDrawFps(bool drawFps) {
 				m_DrawFps = drawFps;
 			}
@@ -0,0 +1,284 @@
+#include "boundingVolumeHierarchy.hpp"
+#include "graphics/mesh.hpp"
+#include "math/matrix4.hpp"
+#include "math/vector3.hpp"
+#include <algorithm>
+#include <array>
+#include <vector>
+
+namespace Hiruki {
+	namespace Graphics {
+		BoundingVolumeHierarchy::Box BoundingVolumeHierarchy::Box::merged(const Box &that) const {
+			return Box(
+				Math::Vector3(std::min(min.x, that.min.x), std::min(min.y, that.min.y), std::min(min.z, that.min.z)),
+				Math::Vector3(std::max(max.x, that.max.x), std::max(max.y, that.max.y), std::max(max.z, that.max.z))
+			);
+		}
+
+		bool BoundingVolumeHierarchy::Box::contains(const Box &that) const {
+			return min.x <= that.min.x && min.y <= that.min.y && min.z <= that.min.z &&
+				   max.x >= that.max.x && max.y >= that.max.y && max.z >= that.max.z;
+		}
+
+		float BoundingVolumeHierarchy::Box::surfaceArea() const {
+			Math::Vector3 size = max.sub(min);
+			return 2 * (size.x * size.y + size.y * size.z + size.z * size.x);
+		}
+
+		BoundingVolumeHierarchy::Box BoundingVolumeHierarchy::computeMeshBox(const Mesh &mesh) {
+			const Math::Matrix4 worldMatrix = mesh.getWorldMatrix();
+
+			Box box;
+			for(int corner = 0; corner < 8; corner++) {
+				const Math::Vector3 objectCorner(
+					corner & 1 ? mesh.boundingBoxMax.x : mesh.boundingBoxMin.x,
+					corner & 2 ? mesh.boundingBoxMax.y : mesh.boundingBoxMin.y,
+					corner & 4 ? mesh.boundingBoxMax.z : mesh.boundingBoxMin.z
+				);
+				const Math::Vector3 worldCorner = worldMatrix.mul(objectCorner);
+				box = corner == 0 ? Box(worldCorner, worldCorner) : box.merged(Box(worldCorner, worldCorner));
+			}
+			return box;
+		}
+
+		void BoundingVolumeHierarchy::update(const std::vector<std::reference_wrapper<const Mesh>> &meshes) {
+			m_UpdateCount++;
+			m_RepeatedMeshes.clear();
+			m_UnboundedMeshes.clear();
+			m_SubmittedLeaves.resize(meshes.size(), NULL_NODE);
+			size_t updatedLeaves = 0;
+
+			for(size_t meshIndex = 0; meshIndex < meshes.size(); meshIndex++) {
+				const Mesh &mesh = meshes[meshIndex];
+
+				// No bounds to cull by, such meshes are left out of the tree until they have some
+				if(mesh.boundingSphereRadius < 0) {
+					m_UnboundedMeshes.push_back(meshIndex);
+					continue;
+				}
+
+				int leaf = m_SubmittedLeaves[meshIndex];
+				bool inserted = false;
+				if(leaf == NULL_NODE || m_Nodes[leaf].mesh != &mesh) {
+					auto [entry, isNew] = m_Leaves.try_emplace(&mesh, NULL_NODE);
+					if(isNew) {
+						entry->second = allocateNode();
+					}
+					leaf = entry->second;
+					inserted = isNew;
+					m_SubmittedLeaves[meshIndex] = leaf;
+				}
+
+				if(m_Nodes[leaf].lastUpdate == m_UpdateCount) {
+					m_RepeatedMeshes.push_back(meshIndex);
+					continue;
+				}
+				updatedLeaves++;
+
+				Node &node = m_Nodes[leaf];
+				const bool moved = inserted ||
+					node.scale.x != mesh.scale.x || node.scale.y != mesh.scale.y || node.scale.z != mesh.scale.z ||
+					node.rotation.x != mesh.rotation.x || node.rotation.y != mesh.rotation.y || node.rotation.z != mesh.rotation.z ||
+					node.translation.x != mesh.translation.x || node.translation.y != mesh.translation.y || node.translation.z != mesh.translation.z;
+
+				node.meshIndex = meshIndex;
+				node.lastUpdate = m_UpdateCount;
+				if(!moved)
+					continue;
+
+				node.mesh = &mesh;
+				node.scale = mesh.scale;
+				node.rotation = mesh.rotation;
+				node.translation = mesh.translation;
+
+				const Box box = computeMeshBox(mesh);
+				if(!inserted && node.box.contains(box))
+					continue;
+
+				if(!inserted) {
+					removeLeaf(leaf);
+				}
+				const Math::Vector3 margin = box.max.sub(box.min).mul(BOX_MARGIN);
+				m_Nodes[leaf].box = Box(box.min.sub(margin), box.max.add(margin));
+				insertLeaf(leaf);
+			}
+
+			// Meshes that were not submitted this time
+			if(updatedLeaves == m_Leaves.size())
+				return;
+
+			for(auto entry = m_Leaves.begin(); entry != m_Leaves.end();) {
+				if(m_Nodes[entry->second].lastUpdate != m_UpdateCount) {
+					removeLeaf(entry->second);
+					freeNode(entry->second);
+					entry = m_Leaves.erase(entry);
+				} else {
+					entry++;
+				}
+			}
+		}
+
+		void BoundingVolumeHierarchy::queryVisible(const Math::Matrix4 &viewProjectionMatrix, std::vector<size_t> &visibleMeshes) const {
+			visibleMeshes.clear();
+			visibleMeshes.insert(visibleMeshes.end(), m_RepeatedMeshes.begin(), m_RepeatedMeshes.end());
+			visibleMeshes.insert(visibleMeshes.end(), m_UnboundedMeshes.begin(), m_UnboundedMeshes.end());
+			if(m_Root == NULL_NODE) {
+				std::sort(visibleMeshes.begin(), visibleMeshes.end());
+				return;
+			}
+
+			// World space planes of the clip space -w <= x, y <= w and 0 <= z <= w planes,
+			// as (a, b, c, d) with a*x + b*y + c*z + d >= 0 inside
+			const Math::Matrix4 &m = viewProjectionMatrix;
+			std::array<std::array<float, 4>, 6> planes;
+			for(int i = 0; i < 4; i++) {
+				planes[0][i] = m[3][i] + m[0][i]; // Left
+				planes[1][i] = m[3][i] - m[0][i]; // Right
+				planes[2][i] = m[3][i] + m[1][i]; // Bottom
+				planes[3][i] = m[3][i] - m[1][i]; // Top
+				planes[4][i] = m[2][i]; // Near
+				planes[5][i] = m[3][i] - m[2][i]; // Far
+			}
+
+			m_Stack.clear();
+			m_Stack.push_back(m_Root);
+			while(!m_Stack.empty()) {
+				const Node &node = m_Nodes[m_Stack.back()];
+				m_Stack.pop_back();
+
+				// The box is outside a plane when its corner furthest along the normal is
+				bool outside = false;
+				for(const std::array<float, 4> &plane : planes) {
+					const float x = plane[0] >= 0 ? node.box.max.x : node.box.min.x;
+					const float y = plane[1] >= 0 ? node.box.max.y : node.box.min.y;
+					const float z = plane[2] >= 0 ? node.box.max.z : node.box.min.z;
+					if(plane[0] * x + plane[1] * y + plane[2] * z + plane[3] < 0) {
+						outside = true;
+						break;
+					}
+				}
+				if(outside)
+					continue;
+
+				if(node.isLeaf()) {
+					visibleMeshes.push_back(node.meshIndex);
+				} else {
+					m_Stack.push_back(node.left);
+					m_Stack.push_back(node.right);
+				}
+			}
+
+			std::sort(visibleMeshes.begin(), visibleMeshes.end());
+		}
+
+		int BoundingVolumeHierarchy::allocateNode() {
+			if(m_FreeNodes == NULL_NODE) {
+				m_Nodes.emplace_back();
+				return m_Nodes.size() - 1;
+			}
+
+			const int node = m_FreeNodes;
+			m_FreeNodes = m_Nodes[node].parent;
+			m_Nodes[node] = Node();
+			return node;
+		}
+
+		void BoundingVolumeHierarchy::freeNode(int node) {
+			// So that m_SubmittedLeaves never matches a freed leaf
+			m_Nodes[node].mesh = nullptr;
+			m_Nodes[node].parent = m_FreeNodes;
+			m_FreeNodes = node;
+		}
+
+		void BoundingVolumeHierarchy::insertLeaf(int leaf) {
+			m_Nodes[leaf].left = NULL_NODE;
+			m_Nodes[leaf].right = NULL_NODE;
+
+			if(m_Root == NULL_NODE) {
+				m_Root = leaf;
+				m_Nodes[leaf].parent = NULL_NODE;
+				return;
+			}
+
+			// Walk down to the sibling that grows the surface area of the tree the least
+			const Box leafBox = m_Nodes[leaf].box;
+			int sibling = m_Root;
+			while(!m_Nodes[sibling].isLeaf()) {
+				const Node &node = m_Nodes[sibling];
+				const float area = node.box.surfaceArea();
+				const float combinedArea = node.box.merged(leafBox).surfaceArea();
+
+				// Cost of pairing the leaf with this node, and the growth every
+				// ancestor of a deeper sibling would inherit
+				const float cost = 2 * combinedArea;
+				const float inheritedCost = 2 * (combinedArea - area);
+
+				float childCosts[2];
+				const int children[2] = {node.left, node.right};
+				for(int i = 0; i < 2; i++) {
+					const Node &child = m_Nodes[children[i]];
+					const float mergedArea = child.box.merged(leafBox).surfaceArea();
+					childCosts[i] = (child.isLeaf() ? mergedArea : mergedArea - child.box.surfaceArea()) + inheritedCost;
+				}
+
+				if(cost < childCosts[0] && cost < childCosts[1])
+					break;
+
+				sibling = childCosts[0] < childCosts[1] ? node.left : node.right;
+			}
+
+			const int oldParent = m_Nodes[sibling].parent;
+			const int newParent = allocateNode();
+			m_Nodes[newParent].parent = oldParent;
+			m_Nodes[newParent].box = m_Nodes[sibling].box.merged(leafBox);
+			m_Nodes[newParent].left = sibling;
+			m_Nodes[newParent].right = leaf;
+			m_Nodes[sibling].parent = newParent;
+			m_Nodes[leaf].parent = newParent;
+
+			if(oldParent == NULL_NODE) {
+				m_Root = newParent;
+			} else {
+				if(m_Nodes[oldParent].left == sibling) {
+					m_Nodes[oldParent].left = newParent;
+				} else {
+					m_Nodes[oldParent].right = newParent;
+				}
+				refitAncestors(oldParent);
+			}
+		}
+
+		void BoundingVolumeHierarchy::removeLeaf(int leaf) {
+			if(leaf == m_Root) {
+				m_Root = NULL_NODE;
+				return;
+			}
+
+			const int parent = m_Nodes[leaf].parent;
+			const int grandParent = m_Nodes[parent].parent;
+			const int sibling = m_Nodes[parent].left == leaf ? m_Nodes[parent].right : m_Nodes[parent].left;
+
+			// The sibling takes the place of the parent
+			m_Nodes[sibling].parent = grandParent;
+			if(grandParent == NULL_NODE) {
+				m_Root = sibling;
+			} else {
+				if(m_Nodes[grandParent].left == parent) {
+					m_Nodes[grandParent].left = sibling;
+				} else {
+					m_Nodes[grandParent].right = sibling;
+				}
+				refitAncestors(grandParent);
+			}
+			freeNode(parent);
+		}
+
+		void BoundingVolumeHierarchy::refitAncestors(int node) {
+			while(node != NULL_NODE) {
+				Node &current = m_Nodes[node];
+				current.box = m_Nodes[current.left].box.merged(m_Nodes[current.right].box);
+				node = current.parent;
+			}
+		}
+	}
+}
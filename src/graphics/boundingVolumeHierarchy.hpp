@@ -0,0 +1,95 @@
+#ifndef HIRUKI_GRAPHICS_BOUNDING_VOLUME_HIERARCHY_H
+#define HIRUKI_GRAPHICS_BOUNDING_VOLUME_HIERARCHY_H
+
+#include "graphics/mesh.hpp"
+#include "math/matrix4.hpp"
+#include "math/vector3.hpp"
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+namespace Hiruki {
+	namespace Graphics {
+		// Dynamic tree of the world space bounding boxes of the submitted meshes, so that
+		// frustum culling only visits the branches of the tree that intersect the view.
+		class BoundingVolumeHierarchy {
+			public:
+				class Box {
+					public:
+						Box() {}
+						Box(const Math::Vector3 &min, const Math::Vector3 &max) : min(min), max(max) {}
+
+						Box merged(const Box &that) const;
+						bool contains(const Box &that) const;
+						float surfaceArea() const;
+
+						Math::Vector3 min;
+						Math::Vector3 max;
+				};
+
+				BoundingVolumeHierarchy() {}
+
+				// Inserts the meshes seen for the first time, removes the ones that are no
+				// longer submitted, and refits the ones whose transform changed since the last
+				// update. The object space bounds of a mesh are assumed to stay the same.
+				void update(const std::vector<std::reference_wrapper<const Mesh>> &meshes);
+				// Replaces the contents of visibleMeshes with the indices, in the meshes of the last
+				// update, of the meshes whose box intersects the view. Sorted, to keep the draw order.
+				void queryVisible(const Math::Matrix4 &viewProjectionMatrix, std::vector<size_t> &visibleMeshes) const;
+
+				size_t size() const { return m_Leaves.size(); }
+
+			private:
+				static constexpr int NULL_NODE = -1;
+				// Leaves are fattened by this fraction of their size on each side, so
+				// that small moves only need a refit instead of a reinsertion
+				static constexpr float BOX_MARGIN = 0.1;
+
+				class Node {
+					public:
+						bool isLeaf() const { return left == NULL_NODE; }
+
+						Box box;
+						// Next free node when the node is not in use
+						int parent = NULL_NODE;
+						int left = NULL_NODE;
+						int right = NULL_NODE;
+
+						// Leaves only
+						const Mesh *mesh = nullptr;
+						size_t meshIndex = 0;
+						uint64_t lastUpdate = 0;
+						Math::Vector3 scale;
+						Math::Vector3 rotation;
+						Math::Vector3 translation;
+				};
+
+				static Box computeMeshBox(const Mesh &mesh);
+
+				int allocateNode();
+				void freeNode(int node);
+				void insertLeaf(int leaf);
+				void removeLeaf(int leaf);
+				void refitAncestors(int node);
+
+				std::vector<Node> m_Nodes;
+				int m_Root = NULL_NODE;
+				int m_FreeNodes = NULL_NODE;
+
+				std::unordered_map<const Mesh *, int> m_Leaves;
+				// Leaf of each mesh of the last update, by index. Meshes are usually submitted
+				// in the same order every frame, which avoids looking them up in m_Leaves.
+				std::vector<int> m_SubmittedLeaves;
+				uint64_t m_UpdateCount = 0;
+				// Meshes submitted more than once in the same update, which always pass the query
+				std::vector<size_t> m_RepeatedMeshes;
+				// Meshes whose bounds were never computed, which are never culled
+				std::vector<size_t> m_UnboundedMeshes;
+
+				mutable std::vector<int> m_Stack;
+		};
+	}
+}
+
+#endif
@@ -1,13 +1,14 @@
 #include "clipping.hpp"
 #include "graphics/texCoord.hpp"
 #include "graphics/triangle.hpp"
+#include <algorithm>
 #include <array>
 #include <cmath>
 #include <vector>
 
 namespace Hiruki {
 	namespace Graphics {
-		Clipping::Clipping(Math::Vector2 fov, float zNear, float zFar) {
+		Clipping::Clipping(Math::Vector2 fov, float zNear, float zFar, float guardBandScale) {
 			fov = fov.div(2);
 			float cosHalfFovX = cos(fov.x);
 			float sinHalfFovX = sin(fov.x);
@@ -22,121 +23,272 @@ namespace Hiruki {
 				Plane(Math::Vector3(0, 0, zNear), Math::Vector3(0, 0, 1)), // Near
 				Plane(Math::Vector3(0, 0, zFar), Math::Vector3(0, 0, -1)), // Far
 			};
+
+			// Scaling the screen extent by guardBandScale scales the tangent of the half fov
+			m_GuardBandScale = guardBandScale;
+			float guardBandFovX = atan(tan(fov.x) * guardBandScale);
+			float guardBandFovY = atan(tan(fov.y) * guardBandScale);
+			float cosGuardBandFovX = cos(guardBandFovX);
+			float sinGuardBandFovX = sin(guardBandFovX);
+			float cosGuardBandFovY = cos(guardBandFovY);
+			float sinGuardBandFovY = sin(guardBandFovY);
+
+			m_GuardBandPlanes = {
+				Plane(Math::Vector3::zero(), Math::Vector3(cosGuardBandFovX, 0, sinGuardBandFovX)), // Left
+				Plane(Math::Vector3::zero(), Math::Vector3(-cosGuardBandFovX, 0, sinGuardBandFovX)), // Right
+				Plane(Math::Vector3::zero(), Math::Vector3(0, -cosGuardBandFovY, sinGuardBandFovY)), // Top
+				Plane(Math::Vector3::zero(), Math::Vector3(0, cosGuardBandFovY, sinGuardBandFovY)), // Down
+			};
+		}
+
+		bool Clipping::isInside(const Triangle &triangle, const Plane &plane) {
+			for(int i = 0; i < 3; i++) {
+				if(triangle.points[i].sub(plane.m_Point).dot(plane.m_Normal) <= 0)
+					return false;
+			}
+			return true;
+		}
+
+		bool Clipping::isOutside(const Triangle &triangle, const Plane &plane) {
+			for(int i = 0; i < 3; i++) {
+				if(triangle.points[i].sub(plane.m_Point).dot(plane.m_Normal) > 0)
+					return false;
+			}
+			return true;
 		}
 		
-		std::vector<Triangle> Clipping::Plane::clipTriangles(const std::vector<Triangle> &triangles) const {
-			std::vector<Triangle> newTriangles;
-			newTriangles.reserve(triangles.size());
-			for(const Triangle &triangle : triangles) {
-				std::array<PointData, 3> insidePoints, outsidePoints;
-				size_t insideCount = 0, outsideCount = 0;
-		
-				for (int i = 0; i < 3; i++) {
-					float dot = triangle.points[i].sub(m_Point).dot(m_Normal);
-		
-					if (dot > 0) {
-						insidePoints[insideCount++] = PointData(
-														triangle.points[i],
-														triangle.texCoords[i],
-														triangle.vertexLights[i],
-														dot
-						);
-					} else {
-						outsidePoints[outsideCount++] = PointData(
-														triangle.points[i],
-														triangle.texCoords[i],
-														triangle.vertexLights[i],
-														dot
-						);
-					}
+		bool Clipping::isSphereOutside(const Math::Vector3 &center, float radius) const {
+			for(const Plane &plane : m_Planes) {
+				if(center.sub(plane.m_Point).dot(plane.m_Normal) < -radius)
+					return true;
+			}
+			return false;
+		}
+
+		uint8_t Clipping::computeOutcode(const Math::Vector4 &point, float sideScale) {
+			const float w = point.w;
+			const float side = w * sideScale;
+
+			uint8_t outcode = 0;
+			if(point.x < -side) outcode |= OUTCODE_LEFT;
+			if(point.x > side) outcode |= OUTCODE_RIGHT;
+			if(point.y < -side) outcode |= OUTCODE_BOTTOM;
+			if(point.y > side) outcode |= OUTCODE_TOP;
+			if(point.z < 0) outcode |= OUTCODE_NEAR;
+			if(point.z > w) outcode |= OUTCODE_FAR;
+			return outcode;
+		}
+
+		size_t Clipping::clipPolygon(const PointData *points, size_t pointCount, PointData *clippedPoints) {
+			size_t clippedCount = 0;
+
+			for(size_t i = 0; i < pointCount; i++) {
+				const PointData &current = points[i];
+				const PointData &next = points[(i + 1) % pointCount];
+
+				if(current.dot > 0) {
+					clippedPoints[clippedCount++] = current;
 				}
 
-				static auto interpolatePointData = [&](const PointData &point1, const PointData &point2) {
-					float t = point1.dot / (point1.dot - point2.dot);
-					Math::Vector3 intersectionPoint = point1.position.lerp(point2.position, t);
-					TexCoord texCoord = point1.texCoord.lerp(point2.texCoord, t);
-					float lightIntensity = std::lerp(point1.lightIntensity, point2.lightIntensity, t);
-					return PointData(intersectionPoint, texCoord, lightIntensity, 0);
-				};
-
-				switch(insideCount) {
-					case 0:
-						continue;
-					case 3:
-						newTriangles.push_back(triangle);
-						continue;
-					case 1: {
-						PointData newPoint0 = interpolatePointData(insidePoints[0], outsidePoints[0]);
-						PointData newPoint1 = interpolatePointData(insidePoints[0], outsidePoints[1]);
-		
-						if(triangle.texture) {
-							newTriangles.emplace_back(Triangle(
-								{insidePoints[0].position, newPoint0.position, newPoint1.position},
-								{insidePoints[0].texCoord, newPoint0.texCoord, newPoint1.texCoord},
-								triangle.texture.value(),
-								{insidePoints[0].lightIntensity, newPoint0.lightIntensity, newPoint1.lightIntensity}
-							));
-						} else {
-							newTriangles.emplace_back(Triangle(
-								{insidePoints[0].position, newPoint0.position, newPoint1.position},
-								triangle.color,
-								{insidePoints[0].lightIntensity, newPoint0.lightIntensity, newPoint1.lightIntensity}
-							));
-						}
-
-						break;
-					}
-					case 2: {
-						PointData newPoint0 = interpolatePointData(insidePoints[0], outsidePoints[0]);
-						PointData newPoint1 = interpolatePointData(insidePoints[1], outsidePoints[0]);
-
-						if(triangle.texture) {
-							newTriangles.emplace_back(Triangle(
-								{insidePoints[0].position, insidePoints[1].position, newPoint0.position},
-								{insidePoints[0].texCoord, insidePoints[1].texCoord, newPoint0.texCoord},
-								triangle.texture.value(),
-								{insidePoints[0].lightIntensity, insidePoints[1].lightIntensity, newPoint0.lightIntensity}
-							));
-							newTriangles.emplace_back(Triangle(
-								{insidePoints[1].position, newPoint1.position, newPoint0.position},
-								{insidePoints[1].texCoord, newPoint1.texCoord, newPoint0.texCoord},
-								triangle.texture.value(),
-								{insidePoints[1].lightIntensity, newPoint1.lightIntensity, newPoint0.lightIntensity}
-							));
-						} else {
-							newTriangles.emplace_back(Triangle(
-								{insidePoints[0].position, insidePoints[1].position, newPoint0.position},
-								triangle.color,
-								{insidePoints[0].lightIntensity, insidePoints[1].lightIntensity, newPoint0.lightIntensity}
-							));
-							newTriangles.emplace_back(Triangle(
-								{insidePoints[1].position, newPoint1.position, newPoint0.position},
-								triangle.color,
-								{insidePoints[1].lightIntensity, newPoint1.lightIntensity, newPoint0.lightIntensity}
-							));
-						}
-		
-						break;
-					}
+				// The edge crosses the plane, keep the intersection point
+				if((current.dot > 0) != (next.dot > 0)) {
+					float t = current.dot / (current.dot - next.dot);
+					clippedPoints[clippedCount++] = PointData(
+						current.position.lerp(next.position, t),
+						current.texCoord.lerp(next.texCoord, t),
+						std::lerp(current.lightIntensity, next.lightIntensity, t),
+						0
+					);
 				}
 			}
-		
-			return newTriangles;
+
+			return clippedCount;
 		}
 		
-		std::vector<Triangle> Clipping::clipTriangle(const Triangle &triangle) const {
-			std::vector<Triangle> triangles = {triangle};
-		
-			for(const Plane &plane : m_Planes) {
-				triangles = plane.clipTriangles(triangles);
+		void Clipping::addTriangleFan(const Triangle &triangle, const PointData *polygon, size_t pointCount,
+									  std::vector<Triangle> &clippedTriangles, bool fixWinding) {
+			for(size_t i = 1; i + 1 < pointCount; i++) {
+				const PointData &point0 = polygon[0];
+				const PointData &point1 = polygon[i];
+				const PointData &point2 = polygon[i + 1];
+
+				if(triangle.texture) {
+					clippedTriangles.emplace_back(
+						std::array<Math::Vector4, 3>{point0.position, point1.position, point2.position},
+						std::array<TexCoord, 3>{point0.texCoord, point1.texCoord, point2.texCoord},
+						*triangle.texture,
+						std::array<float, 3>{point0.lightIntensity, point1.lightIntensity, point2.lightIntensity}
+					);
+				} else {
+					clippedTriangles.emplace_back(
+						std::array<Math::Vector4, 3>{point0.position, point1.position, point2.position},
+						triangle.color,
+						std::array<float, 3>{point0.lightIntensity, point1.lightIntensity, point2.lightIntensity}
+					);
+				}
 
 				// Ensure all triangles are in Counter-Clockwise winding
-				for(Triangle &triangle : triangles) {
-					triangle.fixWinding();
+				if(fixWinding) {
+					clippedTriangles.back().fixWinding();
+				}
+			}
+		}
+
+		void Clipping::clipTriangle(const Triangle &triangle, std::vector<Triangle> &clippedTriangles, bool guardBand) const {
+			clippedTriangles.clear();
+
+			std::array<const Plane *, 6> planes;
+			size_t planeCount = 0;
+
+			if(guardBand) {
+				// Triangles outside a side of the view are never visible. The ones
+				// crossing it are left to the rasterizer, unless they also cross the
+				// guard band, which bounds the screen coordinates it has to handle.
+				for(size_t i = 0; i < m_GuardBandPlanes.size(); i++) {
+					if(isOutside(triangle, m_Planes[i]))
+						return;
+					if(!isInside(triangle, m_GuardBandPlanes[i]))
+						planes[planeCount++] = &m_GuardBandPlanes[i];
+				}
+
+				// Near and far are always clipped against, but most triangles are
+				// inside both and need no clipping at all
+				for(size_t i = m_GuardBandPlanes.size(); i < m_Planes.size(); i++) {
+					if(!isInside(triangle, m_Planes[i]))
+						planes[planeCount++] = &m_Planes[i];
+				}
+			} else {
+				for(const Plane &plane : m_Planes) {
+					planes[planeCount++] = &plane;
 				}
 			}
 
-			return triangles;
+			if(planeCount == 0) {
+				clippedTriangles.push_back(triangle);
+				return;
+			}
+
+			// The polygon is clipped back and forth between two stack buffers
+			std::array<PointData, MAX_POLYGON_VERTICES> polygon, clippedPolygon;
+			size_t pointCount = 3;
+			for(int i = 0; i < 3; i++) {
+				polygon[i] = PointData(triangle.points[i], triangle.texCoords[i], triangle.vertexLights[i], 0);
+			}
+
+			for(size_t i = 0; i < planeCount; i++) {
+				const Plane &plane = *planes[i];
+				for(size_t j = 0; j < pointCount; j++) {
+					polygon[j].dot = polygon[j].position.sub(plane.m_Point).dot(plane.m_Normal);
+				}
+
+				pointCount = clipPolygon(polygon.data(), pointCount, clippedPolygon.data());
+				if(pointCount < 3)
+					return;
+
+				std::swap(polygon, clippedPolygon);
+			}
+
+			addTriangleFan(triangle, polygon.data(), pointCount, clippedTriangles, true);
+		}
+
+		void Clipping::clipTriangleHomogeneous(const Triangle &triangle, std::vector<Triangle> &clippedTriangles, bool guardBand) const {
+			clippedTriangles.clear();
+
+			// Triangles with all their points outside a plane of the view are never visible
+			const uint8_t outcode0 = computeOutcode(triangle.points[0]);
+			const uint8_t outcode1 = computeOutcode(triangle.points[1]);
+			const uint8_t outcode2 = computeOutcode(triangle.points[2]);
+			if(outcode0 & outcode1 & outcode2)
+				return;
+
+			// Only the planes crossed by the triangle need clipping against, with the
+			// sides moved out to the guard band when it is enabled
+			uint8_t clipOutcode = outcode0 | outcode1 | outcode2;
+			if(guardBand) {
+				clipOutcode = computeOutcode(triangle.points[0], m_GuardBandScale) |
+							  computeOutcode(triangle.points[1], m_GuardBandScale) |
+							  computeOutcode(triangle.points[2], m_GuardBandScale);
+			}
+
+			if(clipOutcode == 0) {
+				clippedTriangles.push_back(triangle);
+				return;
+			}
+
+			clipTriangleHomogeneous(triangle, clipOutcode, clippedTriangles, guardBand);
+		}
+
+		void Clipping::clipTriangleHomogeneous(const Triangle &triangle, uint8_t clipOutcode,
+											   std::vector<Triangle> &clippedTriangles, bool guardBand) const {
+			clippedTriangles.clear();
+
+			std::array<PointData, MAX_POLYGON_VERTICES> polygon, clippedPolygon;
+			for(int i = 0; i < 3; i++) {
+				polygon[i] = PointData(triangle.points[i], triangle.texCoords[i], triangle.vertexLights[i], 0);
+			}
+
+			const size_t pointCount = clipPointsHomogeneous(polygon.data(), clippedPolygon.data(), 3, clipOutcode,
+															guardBand ? m_GuardBandScale : 1);
+			if(pointCount < 3)
+				return;
+
+			// Clipping keeps the winding of the polygon
+			addTriangleFan(triangle, polygon.data(), pointCount, clippedTriangles, false);
+		}
+
+		size_t Clipping::clipPolygonHomogeneous(std::array<Math::Vector4, MAX_QUAD_POLYGON_VERTICES> &points,
+												size_t pointCount, uint8_t clipOutcode) {
+			std::array<PointData, MAX_QUAD_POLYGON_VERTICES> polygon, clippedPolygon;
+			for(size_t i = 0; i < pointCount; i++) {
+				polygon[i].position = points[i];
+			}
+
+			pointCount = clipPointsHomogeneous(polygon.data(), clippedPolygon.data(), pointCount, clipOutcode, 1);
+			for(size_t i = 0; i < pointCount; i++) {
+				points[i] = polygon[i].position;
+			}
+			return pointCount;
+		}
+
+		size_t Clipping::clipPointsHomogeneous(PointData *polygon, PointData *clippedPolygon, size_t pointCount,
+											   uint8_t clipOutcode, float sideScale) {
+			// Near first, so that the other planes never see points behind the camera
+			static const std::array<uint8_t, 6> planeOutcodes = {
+				OUTCODE_NEAR, OUTCODE_FAR, OUTCODE_LEFT, OUTCODE_RIGHT, OUTCODE_BOTTOM, OUTCODE_TOP
+			};
+
+			PointData *points = polygon;
+			PointData *clippedPoints = clippedPolygon;
+			for(uint8_t plane : planeOutcodes) {
+				if(!(clipOutcode & plane))
+					continue;
+
+				// Signed distances to the planes are linear in clip space, so are the
+				// attributes, which is why no perspective correction is needed here
+				for(size_t i = 0; i < pointCount; i++) {
+					const Math::Vector4 &position = points[i].position;
+					const float side = position.w * sideScale;
+					switch(plane) {
+						case OUTCODE_LEFT: points[i].dot = position.x + side; break;
+						case OUTCODE_RIGHT: points[i].dot = side - position.x; break;
+						case OUTCODE_BOTTOM: points[i].dot = position.y + side; break;
+						case OUTCODE_TOP: points[i].dot = side - position.y; break;
+						case OUTCODE_NEAR: points[i].dot = position.z; break;
+						case OUTCODE_FAR: points[i].dot = position.w - position.z; break;
+					}
+				}
+
+				pointCount = clipPolygon(points, pointCount, clippedPoints);
+				if(pointCount < 3)
+					return 0;
+
+				std::swap(points, clippedPoints);
+			}
+
+			if(points != polygon) {
+				std::copy(points, points + pointCount, polygon);
+			}
+			return pointCount;
 		}
 	}
 }
@@ -3,8 +3,11 @@
 
 #include "graphics/texCoord.hpp"
 #include "graphics/triangle.hpp"
+#include "math/vector2.hpp"
 #include "math/vector3.hpp"
+#include "math/vector4.hpp"
 #include <array>
+#include <cstdint>
 #include <vector>
 
 namespace Hiruki {
@@ -16,27 +19,87 @@ namespace Hiruki {
 					Plane() {};
 					Plane(Math::Vector3 point, Math::Vector3 normal) : m_Point(point), m_Normal(normal) {};
 		
-					std::vector<Triangle> clipTriangles(const std::vector<Triangle> &triangle) const;
-		
 					Math::Vector3 m_Point;
 					Math::Vector3 m_Normal;
 				};
 				class PointData {
 					public:
 						PointData() {}
-						PointData(const Math::Vector3 &position, const TexCoord &texCoord, const float lightIntensity, float dot)
+						PointData(const Math::Vector4 &position, const TexCoord &texCoord, const float lightIntensity, float dot)
 								: position(position), texCoord(texCoord), lightIntensity(lightIntensity), dot(dot) {}
 
-						Math::Vector3 position;
+						Math::Vector4 position;
 						TexCoord texCoord;
 						float lightIntensity;
 						float dot;
 				};
+
+				// Clipping a triangle against each plane can add at most one vertex
+				static constexpr size_t MAX_POLYGON_VERTICES = 3 + 6;
+				static constexpr size_t MAX_CLIPPED_TRIANGLES = MAX_POLYGON_VERTICES - 2;
+				static constexpr size_t MAX_QUAD_POLYGON_VERTICES = 4 + 6;
+
+				// Outcode bits, set for each clip space plane a point is outside of
+				static constexpr uint8_t OUTCODE_LEFT = 1 << 0; // x < -w
+				static constexpr uint8_t OUTCODE_RIGHT = 1 << 1; // x > w
+				static constexpr uint8_t OUTCODE_BOTTOM = 1 << 2; // y < -w
+				static constexpr uint8_t OUTCODE_TOP = 1 << 3; // y > w
+				static constexpr uint8_t OUTCODE_NEAR = 1 << 4; // z < 0
+				static constexpr uint8_t OUTCODE_FAR = 1 << 5; // z > w
 		
-			Clipping(Math::Vector2 fov, float zNear, float zFar);
-			std::vector<Triangle> clipTriangle(const Triangle &triangle) const;
+			Clipping() {}
+			// With a guard band, triangles are only clipped against the sides of a frustum
+			// guardBandScale times wider and taller than the view, and the rasterizer clips
+			// the parts outside of the view.
+			Clipping(Math::Vector2 fov, float zNear, float zFar, float guardBandScale = 1);
+
+			// Replaces the contents of clippedTriangles with the parts of the view space
+			// triangle inside the planes. Reusing the same vector avoids any allocation
+			// once it has the capacity for MAX_CLIPPED_TRIANGLES.
+			void clipTriangle(const Triangle &triangle, std::vector<Triangle> &clippedTriangles, bool guardBand) const;
+			// Same, for a triangle already projected to homogeneous clip space, which is
+			// clipped against the canonical -w <= x, y <= w and 0 <= z <= w planes
+			void clipTriangleHomogeneous(const Triangle &triangle, std::vector<Triangle> &clippedTriangles, bool guardBand) const;
+			// Clips only against the planes in clipOutcode, for callers that already have the
+			// outcodes of the points and did the trivial accept and reject themselves
+			void clipTriangleHomogeneous(const Triangle &triangle, uint8_t clipOutcode,
+										 std::vector<Triangle> &clippedTriangles, bool guardBand) const;
+			// Clips the convex clip space polygon made of the first pointCount (3 or 4) points
+			// against the planes in clipOutcode, without guard band, replacing them with the
+			// clipped polygon. Returns its amount of points, 0 if nothing is left.
+			static size_t clipPolygonHomogeneous(std::array<Math::Vector4, MAX_QUAD_POLYGON_VERTICES> &points,
+												 size_t pointCount, uint8_t clipOutcode);
+
+			// Whether a view space sphere is entirely outside one of the planes of the view
+			bool isSphereOutside(const Math::Vector3 &center, float radius) const;
+
+			// Outcode of a clip space point, with the sides scaled by sideScale
+			static uint8_t computeOutcode(const Math::Vector4 &point, float sideScale = 1);
+
 			private:
+				// Whether every point of the triangle is strictly inside the plane
+				static bool isInside(const Triangle &triangle, const Plane &plane);
+				// Whether no point of the triangle is inside the plane
+				static bool isOutside(const Triangle &triangle, const Plane &plane);
+
+				// Clips the convex polygon in points (in order) against the plane their
+				// dot is the distance to, writing the result to clippedPoints.
+				// Returns the new amount of points.
+				static size_t clipPolygon(const PointData *points, size_t pointCount, PointData *clippedPoints);
+				// Clips the polygon in points against the clip space planes in clipOutcode, using
+				// clippedPoints (of the same capacity) as scratch. Returns the new amount of points,
+				// 0 if nothing is left, with the clipped polygon in points.
+				static size_t clipPointsHomogeneous(PointData *points, PointData *clippedPoints, size_t pointCount,
+													uint8_t clipOutcode, float sideScale);
+				// Appends the triangle fan of a clipped polygon, with the texture or color of triangle
+				static void addTriangleFan(const Triangle &triangle, const PointData *polygon, size_t pointCount,
+										   std::vector<Triangle> &clippedTriangles, bool fixWinding);
+
+				// Left, right, top, down, near and far
 				std::array<Plane, 6> m_Planes;
+				// Sides of the guard band, in the same order as the first 4 planes
+				std::array<Plane, 4> m_GuardBandPlanes;
+				float m_GuardBandScale;
 		};
 	}
 }
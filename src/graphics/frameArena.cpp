@@ -0,0 +1,49 @@
+#include "frameArena.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <new>
+
+namespace Hiruki {
+	namespace Graphics {
+		FrameArena::Block FrameArena::allocateBlock(size_t size) {
+			return Block(static_cast<std::byte *>(::operator new(size, std::align_val_t(ALIGNMENT))));
+		}
+
+		void FrameArena::reset() {
+			if(!m_Overflow.empty() || !m_Block) {
+				m_Overflow.clear();
+				m_OverflowBytes = 0;
+
+				// Room for the whole last frame, with some headroom
+				m_Capacity = std::max(MIN_CAPACITY, m_HighWaterMark + m_HighWaterMark / 4);
+				m_Capacity = (m_Capacity + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+				m_Block = allocateBlock(m_Capacity);
+			}
+
+			m_Used = 0;
+			m_HighWaterMark = 0;
+		}
+
+		void FrameArena::rewind(size_t marker) {
+			m_Used = std::min(m_Used, marker);
+		}
+
+		void *FrameArena::allocateBytes(size_t size, size_t alignment) {
+			if(alignment > ALIGNMENT)
+				throw std::bad_alloc();
+
+			const size_t offset = (m_Used + alignment - 1) / alignment * alignment;
+			if(m_Block && offset + size <= m_Capacity) {
+				m_Used = offset + size;
+				m_HighWaterMark = std::max(m_HighWaterMark, m_Used + m_OverflowBytes);
+				return m_Block.get() + offset;
+			}
+
+			// Does not fit: served from its own block until the next reset() grows the arena
+			m_Overflow.push_back(allocateBlock(std::max<size_t>(size, 1)));
+			m_OverflowBytes += size;
+			m_HighWaterMark = std::max(m_HighWaterMark, m_Used + m_OverflowBytes);
+			return m_Overflow.back().get();
+		}
+	}
+}
@@ -0,0 +1,67 @@
+#ifndef HIRUKI_GRAPHICS_FRAME_ARENA_H
+#define HIRUKI_GRAPHICS_FRAME_ARENA_H
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+namespace Hiruki {
+	namespace Graphics {
+		// Bump allocator for the transient buffers of a frame. Everything allocated is
+		// released at once by reset(), and nothing is ever destroyed, so it only holds
+		// trivially destructible types. Once the block is as big as the largest frame
+		// seen, frames allocate nothing from the heap.
+		class FrameArena {
+			public:
+				FrameArena() {}
+
+				// Uninitialized storage for count objects, valid until the next reset() or
+				// rewind() past it
+				template<typename T>
+				T *allocate(size_t count) {
+					static_assert(std::is_trivially_destructible_v<T>, "The arena never destroys its objects");
+					return static_cast<T *>(allocateBytes(count * sizeof(T), alignof(T)));
+				}
+
+				// Releases every allocation. Grows the block to the high-water mark when the
+				// last frame did not fit in it.
+				void reset();
+
+				// Allocations made after getMarker() can be released early with rewind(),
+				// as long as no other block was started in between
+				size_t getMarker() const { return m_Used; }
+				void rewind(size_t marker);
+
+				// Most bytes in use at once since the last reset()
+				size_t getHighWaterMark() const { return m_HighWaterMark; }
+				size_t getCapacity() const { return m_Capacity; }
+
+			private:
+				static constexpr size_t ALIGNMENT = 64;
+				static constexpr size_t MIN_CAPACITY = 64 * 1024;
+
+				class BlockDeleter {
+					public:
+						void operator()(std::byte *block) const { ::operator delete(block, std::align_val_t(ALIGNMENT)); }
+				};
+				using Block = std::unique_ptr<std::byte, BlockDeleter>;
+
+				static Block allocateBlock(size_t size);
+
+				void *allocateBytes(size_t size, size_t alignment);
+
+				Block m_Block;
+				size_t m_Capacity = 0;
+				size_t m_Used = 0;
+				size_t m_HighWaterMark = 0;
+				// Blocks of the allocations that did not fit, freed by the next reset().
+				// m_OverflowBytes counts their bytes towards the high-water mark.
+				std::vector<Block> m_Overflow;
+				size_t m_OverflowBytes = 0;
+		};
+	}
+}
+
+#endif
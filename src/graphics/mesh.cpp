@@ -1,10 +1,14 @@
 #include "mesh.hpp"
+#include "graphics/triangle.hpp"
 #include "math/vector3.hpp"
 #include <algorithm>
+#include <bit>
+#include <cmath>
 #include <cstdio>
 #include <filesystem>
 #include <iostream>
 #include <memory>
+#include <numeric>
 #include <optional>
 #include <stdexcept>
 #include <fstream>
@@ -27,7 +31,6 @@ namespace Hiruki {
 
 				std::ifstream meshFile(filename);
 				std::string line;
-				std::vector<TexCoord> texCoords;
 
 				std::unordered_map<std::string, size_t> materialIndexMap;
 
@@ -46,11 +49,19 @@ namespace Hiruki {
 						if(FLIP_X_AXIS)
 							x *= -1;
 
-						mesh->vertices.emplace_back(x, y, z);
+						mesh->vertexStream.push_back(Math::Vector3(x, y, z));
+					} else if(line.starts_with("vn ")) {
+						float x, y, z;
+						std::sscanf(line.c_str(), "vn %f %f %f", &x, &y, &z);
+
+						if(FLIP_X_AXIS)
+							x *= -1;
+
+						mesh->normals.push_back(Math::Vector3(x, y, z).normalized());
 					} else if(line.starts_with("vt ")) {
 						float x, y;
 						std::sscanf(line.c_str(), "vt %f %f", &x, &y);
-						texCoords.emplace_back(x, y);
+						mesh->texCoords.emplace_back(x, y);
 					} else if(line.starts_with("f ")) {
 						Math::Vector3i vertexIndices;
 						Math::Vector3i textureIndices;
@@ -68,15 +79,19 @@ namespace Hiruki {
 							std::swap(normalIndices.y, normalIndices.z);
 						}
 
-						mesh->faces.emplace_back(
-							vertexIndices,
-							std::array<TexCoord, 3> {
-								texCoords.at(textureIndices.x-1),
-								texCoords.at(textureIndices.y-1),
-								texCoords.at(textureIndices.z-1)
-							},
-							currentMaterialIndex
-						);
+						// OBJ indices start at 1, and a missing normal index is read as 0
+						for(int index : {vertexIndices.x, vertexIndices.y, vertexIndices.z}) {
+							mesh->indices.push_back(index - 1);
+						}
+						for(int index : {textureIndices.x, textureIndices.y, textureIndices.z}) {
+							if(index < 1 || index > static_cast<int>(mesh->texCoords.size()))
+								throw std::out_of_range("Texture coordinate index out of range.");
+							mesh->texCoordIndices.push_back(index - 1);
+						}
+						for(int index : {normalIndices.x, normalIndices.y, normalIndices.z}) {
+							mesh->normalIndices.push_back(index >= 1 ? index - 1 : NO_INDEX);
+						}
+						mesh->faceMaterials.push_back(currentMaterialIndex);
 					} else if(line.starts_with("usemtl ")) {
 						char materialName[1024];
 						std::sscanf(line.c_str(), "usemtl %s", materialName);
@@ -87,12 +102,13 @@ namespace Hiruki {
 				}
 
 				std::cout << "  - Found: " << std::endl;
-				std::cout << "\t- " << mesh->faces.size()<< " faces." << std::endl;
-				std::cout << "\t- " << mesh->vertices.size() << " vertices." << std::endl;
+				std::cout << "\t- " << mesh->faceCount() << " faces." << std::endl;
+				std::cout << "\t- " << mesh->vertexStream.size() << " vertices." << std::endl;
 				std::cout << "\t- " << materialIndexMap.size() << " materials." << std::endl;
 
 				meshFile.close();
 				mesh->parseMaterial(filename, materialIndexMap);
+				mesh->updateGeometry();
 		
 				return mesh;
 			}
@@ -175,7 +191,7 @@ namespace Hiruki {
 			Mesh mesh;
 			mesh.scale = Math::Vector3::one();
 
-			mesh.vertices = {
+			for(const Math::Vector3 &vertex : {
 				Math::Vector3(-1, -1, -1),
 				Math::Vector3(1, -1, -1),
 				Math::Vector3(-1, 1, -1),
@@ -184,30 +200,265 @@ namespace Hiruki {
 				Math::Vector3(1, -1, 1),
 				Math::Vector3(-1, 1, 1),
 				Math::Vector3(1, 1, 1),
-			};
+			}) {
+				mesh.vertexStream.push_back(vertex);
+			}
 
-			mesh.faces = {
-				// Front face
-				Mesh::Face(Math::Vector3i(3, 1, 4), {TexCoord(0, 1), TexCoord(0, 0), TexCoord(1, 1)}, 0),
-				Mesh::Face(Math::Vector3i(1, 2, 4), {TexCoord(0, 0), TexCoord(1, 0), TexCoord(1, 1)}, 0),
-				// Right face                                                                       , 0
-				Mesh::Face(Math::Vector3i(4, 2, 8), {TexCoord(0, 1), TexCoord(0, 0), TexCoord(1, 1)}, 0),
-				Mesh::Face(Math::Vector3i(2, 6, 8), {TexCoord(0, 0), TexCoord(1, 0), TexCoord(1, 1)}, 0),
-				// Back face                                                                        , 0
-				Mesh::Face(Math::Vector3i(8, 6, 7), {TexCoord(0, 1), TexCoord(0, 0), TexCoord(1, 1)}, 0),
-				Mesh::Face(Math::Vector3i(6, 5, 7), {TexCoord(0, 0), TexCoord(1, 0), TexCoord(1, 1)}, 0),
-				// Left face                                                                        , 0
-				Mesh::Face(Math::Vector3i(7, 5, 3), {TexCoord(0, 1), TexCoord(0, 0), TexCoord(1, 1)}, 0),
-				Mesh::Face(Math::Vector3i(5, 1, 3), {TexCoord(0, 0), TexCoord(1, 0), TexCoord(1, 1)}, 0),
-				// Top face                                                                         , 0
-				Mesh::Face(Math::Vector3i(7, 3, 8), {TexCoord(0, 1), TexCoord(0, 0), TexCoord(1, 1)}, 0),
-				Mesh::Face(Math::Vector3i(3, 4, 8), {TexCoord(0, 0), TexCoord(1, 0), TexCoord(1, 1)}, 0),
-				// Bottom face                                                                      , 0
-				Mesh::Face(Math::Vector3i(1, 5, 2), {TexCoord(0, 1), TexCoord(0, 0), TexCoord(1, 1)}, 0),
-				Mesh::Face(Math::Vector3i(5, 6, 2), {TexCoord(0, 0), TexCoord(1, 0), TexCoord(1, 1)}, 0),
-			};
+			const std::array<TexCoord, 3> upperTexCoords = {TexCoord(0, 1), TexCoord(0, 0), TexCoord(1, 1)};
+			const std::array<TexCoord, 3> lowerTexCoords = {TexCoord(0, 0), TexCoord(1, 0), TexCoord(1, 1)};
+
+			// Front face
+			mesh.addFace({2, 0, 3}, upperTexCoords);
+			mesh.addFace({0, 1, 3}, lowerTexCoords);
+			// Right face
+			mesh.addFace({3, 1, 7}, upperTexCoords);
+			mesh.addFace({1, 5, 7}, lowerTexCoords);
+			// Back face
+			mesh.addFace({7, 5, 6}, upperTexCoords);
+			mesh.addFace({5, 4, 6}, lowerTexCoords);
+			// Left face
+			mesh.addFace({6, 4, 2}, upperTexCoords);
+			mesh.addFace({4, 0, 2}, lowerTexCoords);
+			// Top face
+			mesh.addFace({6, 2, 7}, upperTexCoords);
+			mesh.addFace({2, 3, 7}, lowerTexCoords);
+			// Bottom face
+			mesh.addFace({0, 4, 1}, upperTexCoords);
+			mesh.addFace({4, 5, 1}, lowerTexCoords);
+			mesh.updateGeometry();
 			
 			return mesh;
 		}
+
+		void Mesh::addFace(const std::array<uint32_t, 3> &vertexIndices, const std::array<TexCoord, 3> &faceTexCoords, uint32_t material) {
+			for(int i = 0; i < 3; i++) {
+				indices.push_back(vertexIndices[i]);
+				normalIndices.push_back(NO_INDEX);
+				texCoordIndices.push_back(texCoords.size());
+				texCoords.push_back(faceTexCoords[i]);
+			}
+			faceMaterials.push_back(material);
+		}
+
+		void Mesh::updateGeometry() {
+			m_WorldVerticesValid = false;
+			m_WorldNormalsValid = false;
+
+			// Every corner must index a normal, Goraud shading reads them
+			generateNormals();
+
+			// Identical texture coordinates share one entry, keyed by their bits
+			std::unordered_map<uint64_t, uint32_t> uniqueTexCoords;
+			std::vector<uint32_t> remap(texCoords.size());
+			std::vector<TexCoord> mergedTexCoords;
+			for(size_t i = 0; i < texCoords.size(); i++) {
+				const uint64_t key = static_cast<uint64_t>(std::bit_cast<uint32_t>(texCoords[i].u)) << 32 | std::bit_cast<uint32_t>(texCoords[i].v);
+				auto [entry, isNew] = uniqueTexCoords.try_emplace(key, mergedTexCoords.size());
+				if(isNew) {
+					mergedTexCoords.push_back(texCoords[i]);
+				}
+				remap[i] = entry->second;
+			}
+			for(uint32_t &index : texCoordIndices) {
+				index = remap[index];
+			}
+			texCoords = std::move(mergedTexCoords);
+
+			buildSubmeshes();
+
+			computeBounds();
+		}
+
+		void Mesh::buildSubmeshes() {
+			submeshes.clear();
+
+			// Stable, so the faces of a material keep their order
+			std::unordered_map<uint32_t, uint32_t> materialRanks;
+			std::vector<uint32_t> faceRanks;
+			faceRanks.reserve(faceCount());
+			for(uint32_t material : faceMaterials) {
+				faceRanks.push_back(materialRanks.try_emplace(material, materialRanks.size()).first->second);
+			}
+			std::vector<uint32_t> order(faceCount());
+			std::iota(order.begin(), order.end(), 0);
+			std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+				return faceRanks[a] < faceRanks[b];
+			});
+
+			if(!std::is_sorted(order.begin(), order.end())) {
+				auto reorder = [&](std::vector<uint32_t> &buffer, size_t stride) {
+					std::vector<uint32_t> sorted;
+					sorted.reserve(buffer.size());
+					for(uint32_t face : order) {
+						sorted.insert(sorted.end(), buffer.begin() + face * stride, buffer.begin() + (face + 1) * stride);
+					}
+					buffer = std::move(sorted);
+				};
+				reorder(indices, 3);
+				reorder(normalIndices, 3);
+				reorder(texCoordIndices, 3);
+				reorder(faceMaterials, 1);
+			}
+
+			for(uint32_t face = 0; face < faceCount(); face++) {
+				if(submeshes.empty() || submeshes.back().material != faceMaterials[face]) {
+					submeshes.push_back(Submesh{face, 0, faceMaterials[face]});
+				}
+				submeshes.back().faceCount++;
+			}
+		}
+
+		void Mesh::computeBounds() {
+			if(vertexStream.empty()) {
+				boundingBoxMin = boundingBoxMax = boundingSphereCenter = Math::Vector3::zero();
+				boundingSphereRadius = 0;
+				return;
+			}
+
+			// One pass per component, over contiguous arrays
+			const Math::FloatStream *components[3] = {&vertexStream.x, &vertexStream.y, &vertexStream.z};
+			float min[3], max[3];
+			for(int i = 0; i < 3; i++) {
+				auto [minValue, maxValue] = std::minmax_element(components[i]->begin(), components[i]->end());
+				min[i] = *minValue;
+				max[i] = *maxValue;
+			}
+			boundingBoxMin = Math::Vector3(min[0], min[1], min[2]);
+			boundingBoxMax = Math::Vector3(max[0], max[1], max[2]);
+
+			// Centered on the box, which is tighter than half its diagonal for most meshes
+			boundingSphereCenter = boundingBoxMin.add(boundingBoxMax).mul(0.5f);
+			float radiusSquared = 0;
+			for(size_t i = 0; i < vertexStream.size(); i++) {
+				const float x = vertexStream.x[i] - boundingSphereCenter.x;
+				const float y = vertexStream.y[i] - boundingSphereCenter.y;
+				const float z = vertexStream.z[i] - boundingSphereCenter.z;
+				radiusSquared = std::max(radiusSquared, x * x + y * y + z * z);
+			}
+			boundingSphereRadius = std::sqrt(radiusSquared);
+		}
+
+		void Mesh::generateNormals() {
+			// Faces with a missing or a generated normal at any corner get generated
+			// normals at all their corners, rebuilt from the current vertices
+			const uint32_t generatedEnd = m_GeneratedNormalsBegin + m_GeneratedNormalCount;
+			auto isAuthored = [&](uint32_t index) {
+				return index < normals.size() && (index < m_GeneratedNormalsBegin || index >= generatedEnd);
+			};
+			std::vector<bool> generatedFaces(faceCount());
+			bool anyGenerated = false;
+			for(size_t face = 0; face < faceCount(); face++) {
+				const size_t corner = face * 3;
+				generatedFaces[face] = !isAuthored(normalIndices[corner]) || !isAuthored(normalIndices[corner + 1]) || !isAuthored(normalIndices[corner + 2]);
+				anyGenerated = anyGenerated || generatedFaces[face];
+			}
+
+			// The last generated set is rebuilt in place, unless the vertex count changed
+			if(m_GeneratedNormalCount > 0 && (!anyGenerated || m_GeneratedNormalCount != vertexStream.size())) {
+				removeGeneratedNormals();
+			}
+			if(!anyGenerated)
+				return;
+
+			if(m_GeneratedNormalCount == 0) {
+				// Appended after the authored normals, one per vertex
+				m_GeneratedNormalsBegin = normals.size();
+				m_GeneratedNormalCount = vertexStream.size();
+				normals.resize(normals.size() + m_GeneratedNormalCount);
+			}
+
+			// Only summed over the faces using them, so that the faces with authored
+			// (for example flat) normals do not bend the normals of their neighbours
+			std::vector<Math::Vector3> vertexNormals(vertexStream.size(), Math::Vector3::zero());
+			for(size_t face = 0; face < faceCount(); face++) {
+				if(!generatedFaces[face])
+					continue;
+
+				const size_t i = face * 3;
+				Math::Vector3 faceNormal = Triangle({
+					vertexStream[indices[i]],
+					vertexStream[indices[i + 1]],
+					vertexStream[indices[i + 2]]
+				}).calculateNormal();
+
+				for(int corner = 0; corner < 3; corner++) {
+					vertexNormals[indices[i + corner]] = vertexNormals[indices[i + corner]].add(faceNormal);
+					normalIndices[i + corner] = m_GeneratedNormalsBegin + indices[i + corner];
+				}
+			}
+
+			for(size_t vertex = 0; vertex < vertexNormals.size(); vertex++) {
+				normals[m_GeneratedNormalsBegin + vertex] = vertexNormals[vertex].normalized();
+			}
+		}
+
+		void Mesh::removeGeneratedNormals() {
+			const uint32_t generatedEnd = m_GeneratedNormalsBegin + m_GeneratedNormalCount;
+			for(uint32_t &index : normalIndices) {
+				if(index >= normals.size() || (index >= m_GeneratedNormalsBegin && index < generatedEnd)) {
+					index = NO_INDEX;
+				} else if(index >= generatedEnd) {
+					index -= m_GeneratedNormalCount;
+				}
+			}
+
+			normals.erase(normals.begin() + m_GeneratedNormalsBegin, normals.begin() + generatedEnd);
+			m_GeneratedNormalsBegin = 0;
+			m_GeneratedNormalCount = 0;
+		}
+
+		void Mesh::validateWorldCache() const {
+			const bool transformChanged =
+				m_CachedScale.x != scale.x || m_CachedScale.y != scale.y || m_CachedScale.z != scale.z ||
+				m_CachedRotation.x != rotation.x || m_CachedRotation.y != rotation.y || m_CachedRotation.z != rotation.z ||
+				m_CachedTranslation.x != translation.x || m_CachedTranslation.y != translation.y || m_CachedTranslation.z != translation.z;
+
+			if(transformChanged) {
+				m_WorldVerticesValid = false;
+				m_WorldNormalsValid = false;
+				m_CachedScale = scale;
+				m_CachedRotation = rotation;
+				m_CachedTranslation = translation;
+			}
+		}
+
+		void Mesh::updateWorldCache(bool worldVertices, bool worldNormals) const {
+			validateWorldCache();
+
+			if(worldVertices && !m_WorldVerticesValid) {
+				const Math::Matrix4 worldMatrix = getWorldMatrix();
+				m_WorldVertices.clear();
+				m_WorldVertices.reserve(vertexStream.size());
+				for(size_t i = 0; i < vertexStream.size(); i++) {
+					m_WorldVertices.push_back(worldMatrix.mul(vertexStream[i]));
+				}
+
+				m_WorldVerticesValid = true;
+			}
+
+			if(worldNormals && !m_WorldNormalsValid) {
+				// Normals transform by the inverse transpose of the world matrix, which is the
+				// rotation times the inverse scale (translations do not apply to directions)
+				const Math::Matrix4 rotationMatrix = Math::Matrix4::rotateXYZ(rotation);
+				m_WorldNormals.clear();
+				m_WorldNormals.reserve(normals.size());
+				for(const Math::Vector3 &normal : normals) {
+					const Math::Vector3 scaledNormal(normal.x / scale.x, normal.y / scale.y, normal.z / scale.z);
+					m_WorldNormals.push_back(Math::Vector3(rotationMatrix.mul(scaledNormal)).normalized());
+				}
+
+				m_WorldNormalsValid = true;
+			}
+		}
+
+		const std::vector<Math::Vector3> &Mesh::getWorldVertices() const {
+			updateWorldCache(true, false);
+			return m_WorldVertices;
+		}
+
+		const std::vector<Math::Vector3> &Mesh::getWorldNormals() const {
+			updateWorldCache(false, true);
+			return m_WorldNormals;
+		}
 	}
 }
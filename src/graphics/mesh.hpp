@@ -3,7 +3,9 @@
 
 #include "graphics/material.hpp"
 #include "graphics/texCoord.hpp"
+#include "math/matrix4.hpp"
 #include "math/vector3.hpp"
+#include "math/vectorStream.hpp"
 #include <cstdint>
 #include <memory>
 #include <string>
@@ -15,17 +17,15 @@ namespace Hiruki {
 	namespace Graphics {
 		class Mesh {
 			public:
-				class Face {
+				// Marks a missing entry in the per corner index buffers
+				static constexpr uint32_t NO_INDEX = UINT32_MAX;
+
+				// Contiguous range of faces sharing a material
+				class Submesh {
 					public:
-						inline Face(const Math::Vector3i &vertexIndices, const std::array<TexCoord, 3> &texCoords, const size_t textureIndex)
-								: vertexIndices(vertexIndices), texCoords(texCoords), textureIndex(textureIndex) {}
-						inline Face(const Math::Vector3i &vertexIndices, uint32_t color)
-								: vertexIndices(vertexIndices), color(color) {};
-
-						size_t textureIndex = 0;
-						Math::Vector3i vertexIndices = Math::Vector3i(1, 1, 1);
-						uint32_t color = 0xFFFFFFFF;
-						std::array<TexCoord, 3> texCoords = {TexCoord(0, 0), TexCoord(0,0), TexCoord(0,0)};
+						uint32_t firstFace = 0;
+						uint32_t faceCount = 0;
+						size_t material = 0;
 				};
 
 				Mesh() : scale(Math::Vector3::one()) {};
@@ -39,13 +39,90 @@ namespace Hiruki {
 					return mesh;
 				};
 
-				std::vector<Math::Vector3> vertices;
-				std::vector<Face> faces;
+				// Appends a face, of three 0-based vertex indices and its texture coordinates,
+				// with no normals (updateGeometry() generates them). Loaders fill the index buffers
+				// directly instead.
+				void addFace(const std::array<uint32_t, 3> &vertexIndices, const std::array<TexCoord, 3> &faceTexCoords = {}, uint32_t material = 0);
+				size_t faceCount() const { return faceMaterials.size(); }
+
+				// Must be called again after changing the vertices, normals or faces. Generates the
+				// missing normals, rebuilds the bounds, merges the identical texture coordinates,
+				// groups the faces by material into submeshes, and invalidates the world space caches.
+				void updateGeometry();
+				// Smooth normals (the normals of the faces without authored normals, averaged at
+				// each vertex) for the faces with a missing (NO_INDEX or out of range) normal index.
+				// Calling it again rebuilds them from the current vertices, in the same range.
+				void generateNormals();
+
+				// Object space -> World space
+				Math::Matrix4 getWorldMatrix() const {
+					Math::Matrix4 scaleMatrix = Math::Matrix4::scale(scale);
+					Math::Matrix4 rotationMatrix = Math::Matrix4::rotateXYZ(rotation);
+					Math::Matrix4 translationMatrix = Math::Matrix4::translate(translation);
+
+					return translationMatrix.mul(rotationMatrix.mul(scaleMatrix));
+				}
+
+				// World space positions of the vertices, and world space normals, indexed like
+				// normals. Cached between frames, until the transform changes or updateGeometry()
+				// is called, so static meshes only compute them once.
+				const std::vector<Math::Vector3> &getWorldVertices() const;
+				const std::vector<Math::Vector3> &getWorldNormals() const;
+				// Brings the requested caches up to date, so that the getters above only read
+				// them. Different meshes can be updated from different threads, but not one mesh.
+				void updateWorldCache(bool worldVertices, bool worldNormals) const;
+
+				// Object space positions, one aligned array per component, for the batch transforms
+				Math::Vector3Stream vertexStream;
+				// Object space, normalized
+				std::vector<Math::Vector3> normals;
+				std::vector<TexCoord> texCoords;
+
+				// Three 0-based indices per face, into vertexStream, normals and texCoords
+				std::vector<uint32_t> indices;
+				std::vector<uint32_t> normalIndices;
+				std::vector<uint32_t> texCoordIndices;
+				// Key in m_Materials of each face
+				std::vector<uint32_t> faceMaterials;
+				// Faces of each material, in order of first use
+				std::vector<Submesh> submeshes;
+
 				Math::Vector3 scale;
 				Math::Vector3 rotation;
 				Math::Vector3 translation;
 
+				// Object space bounds of the vertices, used to cull whole meshes
+				Math::Vector3 boundingBoxMin;
+				Math::Vector3 boundingBoxMax;
+				Math::Vector3 boundingSphereCenter;
+				// Negative until updateGeometry() is first called, such meshes are never culled
+				float boundingSphereRadius = -1;
+
+				// Large meshes (walls, floors, buildings) drawn first into the occlusion
+				// buffer, so that the meshes behind them can be skipped
+				bool occluder = false;
+
 				std::unordered_map<size_t, Material> m_Materials = {{0, Material()}}; // Fallback material
+
+			private:
+				void buildSubmeshes();
+				// Removes the generated normals from normals, the faces using them get NO_INDEX
+				void removeGeneratedNormals();
+				void computeBounds();
+				// Drops the caches when the transform differs from the one they were computed with
+				void validateWorldCache() const;
+
+				// Range of normals written by generateNormals(), one per vertex
+				uint32_t m_GeneratedNormalsBegin = 0;
+				uint32_t m_GeneratedNormalCount = 0;
+
+				mutable std::vector<Math::Vector3> m_WorldVertices;
+				mutable std::vector<Math::Vector3> m_WorldNormals;
+				mutable bool m_WorldVerticesValid = false;
+				mutable bool m_WorldNormalsValid = false;
+				mutable Math::Vector3 m_CachedScale;
+				mutable Math::Vector3 m_CachedRotation;
+				mutable Math::Vector3 m_CachedTranslation;
 		};
 	}
 }
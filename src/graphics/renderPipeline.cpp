@@ -6,16 +6,23 @@
 #include <SDL2/SDL_render.h>
 #include <algorithm>
 #include <array>
+#include <cfloat>
 #include <cmath>
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <functional>
+#include <new>
+#include <numeric>
 #include <stdexcept>
 #include <vector>
 #include <omp.h>
 
+#ifdef HIRUKI_RASTER_SIMD
+#include <immintrin.h>
+#endif
+
 namespace Hiruki {
 	namespace Graphics {
 		RenderPipeline::RenderPipeline(int renderWidth, int renderHeight, SDL_Renderer *renderer) {
@@ -31,11 +38,31 @@ namespace Hiruki {
 
 			m_PixelBuffer.resize(renderWidth * renderHeight, 0);
 			m_DepthBuffer.resize(renderWidth * renderHeight, 0);
+			m_VisibilityBuffer.resize(renderWidth * renderHeight, 0);
+			resizeHiZBuffer();
 
 			m_DrawMode = DrawMode::TEXTURED;
 			m_ShadingMode = ShadingMode::NONE;
 			m_WireframeEnabled = false;
 			m_WireframeColor = 0xFFFFFFFF;
+
+			m_DepthTestEnabled = true;
+			m_DepthWriteEnabled = true;
+			m_HiZEnabled = true;
+			m_VisibilityBufferEnabled = false;
+			m_GuardBandEnabled = true;
+			m_FrustumCullingEnabled = true;
+			m_BoundingVolumeHierarchyEnabled = false;
+			m_OcclusionCullingEnabled = true;
+			m_OcclusionBuffer.resize(OCCLUSION_BUFFER_WIDTH * OCCLUSION_BUFFER_HEIGHT);
+			m_ClippedTriangles.reserve(Clipping::MAX_CLIPPED_TRIANGLES);
+			m_ClippingMode = ClippingMode::CLIP_SPACE;
+			updateProjection();
+
+			m_BinningEnabled = true;
+			resizeTileBins();
+
+			setRasterKernel(RasterKernel::AVX2);
 		}
 		
 		RenderPipeline::~RenderPipeline() {
@@ -48,6 +75,8 @@ namespace Hiruki {
 
 			m_PixelBuffer.resize(renderWidth * renderHeight, 0);
 			m_DepthBuffer.resize(renderWidth * renderHeight, 0);
+			m_VisibilityBuffer.resize(renderWidth * renderHeight, 0);
+			resizeHiZBuffer();
 			
 			SDL_DestroyTexture(m_PixelBufferTexture);
 			m_PixelBufferTexture = SDL_CreateTexture(
@@ -56,146 +85,282 @@ namespace Hiruki {
 										SDL_TEXTUREACCESS_STREAMING, 
 										renderWidth, renderHeight
 			);
+
+			resizeTileBins();
+			updateProjection();
+		}
+
+		void RenderPipeline::updateProjection() {
+			float fovy = FOV_Y * M_PI / 180.0;
+			float aspectX = static_cast<float>(m_PixelBufferWidth) / m_PixelBufferHeight;
+			float fovx = atan(tan((FOV_Y * M_PI / 180.0) / 2.0) * aspectX) * 2;
+
+			m_ProjectionMatrix = Math::Matrix4::perspective(m_PixelBufferHeight, m_PixelBufferWidth, FOV_Y, Z_NEAR, Z_FAR);
+			m_Clipper = Clipping(Math::Vector2(fovx, fovy), Z_NEAR, Z_FAR, GUARD_BAND_SCALE);
+		}
+
+		bool RenderPipeline::isMeshOutsideView(const Mesh &mesh, const Math::Matrix4 &modelViewMatrix) const {
+			if(mesh.boundingSphereRadius < 0)
+				return false;
+
+			// Rotations and translations keep distances, so only the largest scale grows the sphere
+			const float maxScale = std::max({std::fabs(mesh.scale.x), std::fabs(mesh.scale.y), std::fabs(mesh.scale.z)});
+			const Math::Vector3 viewCenter = modelViewMatrix.mul(mesh.boundingSphereCenter);
+			if(m_Clipper.isSphereOutside(viewCenter, mesh.boundingSphereRadius * maxScale))
+				return true;
+
+			// The sphere is loose for long meshes, the box corners are tighter
+			uint8_t outcode = 0xFF;
+			for(int corner = 0; corner < 8; corner++) {
+				const Math::Vector3 objectCorner(
+					corner & 1 ? mesh.boundingBoxMax.x : mesh.boundingBoxMin.x,
+					corner & 2 ? mesh.boundingBoxMax.y : mesh.boundingBoxMin.y,
+					corner & 4 ? mesh.boundingBoxMax.z : mesh.boundingBoxMin.z
+				);
+				const Math::Vector4 clipCorner = m_ProjectionMatrix.mul(modelViewMatrix.mul(objectCorner));
+				outcode &= Clipping::computeOutcode(clipCorner);
+				if(outcode == 0)
+					return false;
+			}
+			return true;
+		}
+
+		void RenderPipeline::resizeHiZBuffer() {
+			m_HiZWidth = (m_PixelBufferWidth + BLOCK_SIZE - 1) / BLOCK_SIZE;
+			m_HiZHeight = (m_PixelBufferHeight + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+			m_HiZBuffer.resize(m_HiZWidth * m_HiZHeight, 0);
+		}
+
+		void RenderPipeline::resizeTileBins() {
+			m_TileCountX = (m_PixelBufferWidth + TILE_SIZE - 1) / TILE_SIZE;
+			m_TileCountY = (m_PixelBufferHeight + TILE_SIZE - 1) / TILE_SIZE;
 		}
 
 		void RenderPipeline::render(const std::vector<std::reference_wrapper<const Mesh>> &meshes,
 									const Scene::Camera &camera, const size_t numThreads,
 							  		const Math::Vector3 &lightDirection) {
+			m_Stats = Stats();
+			m_FrameArena.reset();
+
 			std::memset(m_PixelBuffer.data(), 0, m_PixelBuffer.size() * sizeof(uint32_t));
 			for(size_t i = 0; i < m_DepthBuffer.size(); i++) {
 				m_DepthBuffer[i] = 1.0f;
 			}
+			std::fill(m_HiZBuffer.begin(), m_HiZBuffer.end(), 1.0f);
 
-			static const float FOV_Y = 60.0;
-			static const float Z_FAR = 50.0;
-			static const float Z_NEAR = 0.1;
-
-			float fovy = FOV_Y * M_PI / 180.0;
-			float aspectX = static_cast<float>(m_PixelBufferWidth) / m_PixelBufferHeight;
-			float fovx = atan(tan((FOV_Y * M_PI / 180.0) / 2.0) * aspectX) * 2;
-
-
-			Math::Matrix4 projectionMatrix = Math::Matrix4::perspective(m_PixelBufferHeight, m_PixelBufferWidth, FOV_Y, Z_NEAR, Z_FAR);
 			Math::Matrix4 viewMatrix = Math::Matrix4::lookAt(camera.getPosition(), camera.getTarget(), camera.getUp());
+			const bool clipSpace = m_ClippingMode == ClippingMode::CLIP_SPACE;
+
+			// Binning replaces the per-triangle parallel loops, so it is only
+			// worth it when there is more than one thread to distribute tiles to.
+			const bool binned = m_BinningEnabled && numThreads > 1;
+			// Deferred shading resolves the visibility buffer once every triangle is rasterized
+			const bool deferred = m_VisibilityBufferEnabled;
+			// Both draw the wireframe once every triangle is rasterized
+			const bool collected = binned || deferred;
+
+			if(deferred) {
+				std::fill(m_VisibilityBuffer.begin(), m_VisibilityBuffer.end(), 0);
+			}
 
-			Clipping clipper(Math::Vector2(fovx, fovy), Z_NEAR, Z_FAR);
+			// The tree only keeps the meshes whose world space box intersects the view,
+			// the finer tests below still apply to them
+			const bool hierarchy = m_FrustumCullingEnabled && m_BoundingVolumeHierarchyEnabled;
+			if(hierarchy) {
+				m_BoundingVolumeHierarchy.update(meshes);
+				m_BoundingVolumeHierarchy.queryVisible(m_ProjectionMatrix.mul(viewMatrix), m_VisibleMeshes);
+				m_Stats.culledMeshes += meshes.size() - m_VisibleMeshes.size();
+			}
 
-			for(const Mesh &mesh : meshes) {
-				Math::Matrix4 scaleMatrix = Math::Matrix4::scale(mesh.scale);
-				Math::Matrix4 rotationMatrix = Math::Matrix4::rotateXYZ(mesh.rotation);
-				Math::Matrix4 translationMatrix = Math::Matrix4::translate(mesh.translation);
+			const size_t meshCount = hierarchy ? m_VisibleMeshes.size() : meshes.size();
 
-				Math::Matrix4 worldMatrix = translationMatrix.mul(rotationMatrix.mul(scaleMatrix));
+			// Occluders are drawn first, so that every other mesh can be tested against them. Only
+			// valid when the occluders do hide what is behind them in the depth buffer.
+			bool occludersDrawn = false;
+			if(m_OcclusionCullingEnabled && m_DepthTestEnabled && m_DepthWriteEnabled) {
+				std::fill(m_OcclusionBuffer.begin(), m_OcclusionBuffer.end(), 1.0f);
+				for(size_t meshIndex = 0; meshIndex < meshCount; meshIndex++) {
+					const Mesh &mesh = meshes[hierarchy ? m_VisibleMeshes[meshIndex] : meshIndex];
+					if(!mesh.occluder)
+						continue;
 
-				std::vector<Math::Vector3> worldVertices;
-				worldVertices.reserve(mesh.vertices.size());
+					const Math::Matrix4 modelViewMatrix = viewMatrix.mul(mesh.getWorldMatrix());
+					if(m_FrustumCullingEnabled && isMeshOutsideView(mesh, modelViewMatrix))
+						continue;
 
-				std::vector<Math::Vector3> vertexNormals(mesh.vertices.size(), Math::Vector3::zero());
-				std::vector<float> vertexLightIntensities(mesh.vertices.size(), 0.0f);
+					rasterizeOccluder(mesh, modelViewMatrix);
+					occludersDrawn = true;
+				}
+			}
+
+			// View space positions are only needed to light flat shaded triangles, and by the
+			// view space clipper. They are computed from the world space ones cached by the mesh.
+			const bool needsViewVertices = !clipSpace || m_ShadingMode == ShadingMode::FLAT;
+			const bool needsVertexLights = m_ShadingMode == ShadingMode::GORAUD;
+
+			// Meshes left after culling, with their vertex stage buffers
+			MeshGeometry *geometries = m_FrameArena.allocate<MeshGeometry>(meshCount);
+			uint32_t geometryCount = 0;
+			for(size_t meshIndex = 0; meshIndex < meshCount; meshIndex++) {
+				const Mesh &mesh = meshes[hierarchy ? m_VisibleMeshes[meshIndex] : meshIndex];
+				const Math::Matrix4 modelViewMatrix = viewMatrix.mul(mesh.getWorldMatrix());
+
+				if(m_FrustumCullingEnabled && isMeshOutsideView(mesh, modelViewMatrix)) {
+					m_Stats.culledMeshes++;
+					continue;
+				}
 
-				for(const Math::Vector3 &vertex : mesh.vertices) {
-					worldVertices.push_back(worldMatrix.mul(vertex));
+				if(occludersDrawn && !mesh.occluder && isMeshOccluded(mesh, modelViewMatrix)) {
+					m_Stats.occludedMeshes++;
+					continue;
 				}
 
-				for(const Mesh::Face &face: mesh.faces) {
-					Math::Vector3 faceNormal = Triangle({
-						worldVertices[face.vertexIndices.x-1],
-						worldVertices[face.vertexIndices.y-1],
-						worldVertices[face.vertexIndices.z-1]
-					}).calculateNormal();
+				MeshGeometry &geometry = geometries[geometryCount++];
+				geometry.mesh = &mesh;
+				geometry.modelViewProjectionMatrix = m_ProjectionMatrix.mul(modelViewMatrix);
+				geometry.updatesWorldCache = true;
 
-					vertexNormals[face.vertexIndices.x-1] = vertexNormals[face.vertexIndices.x-1].add(faceNormal);
-					vertexNormals[face.vertexIndices.y-1] = vertexNormals[face.vertexIndices.y-1].add(faceNormal);
-					vertexNormals[face.vertexIndices.z-1] = vertexNormals[face.vertexIndices.z-1].add(faceNormal);
+				geometry.vertexOutcodes = m_FrameArena.allocate<uint8_t>(mesh.vertexStream.size());
+				geometry.vertexClipOutcodes = m_FrameArena.allocate<uint8_t>(mesh.vertexStream.size());
+				geometry.viewVertices = needsViewVertices ? m_FrameArena.allocate<Math::Vector4>(mesh.vertexStream.size()) : nullptr;
+				geometry.vertexLights = needsVertexLights ? m_FrameArena.allocate<float>(mesh.normals.size()) : nullptr;
+			}
+
+			// A mesh added more than once gets a geometry each, which may run on different
+			// threads. Only the first one updates the caches of the mesh.
+			uint32_t *meshOrder = m_FrameArena.allocate<uint32_t>(geometryCount);
+			std::iota(meshOrder, meshOrder + geometryCount, 0);
+			std::sort(meshOrder, meshOrder + geometryCount, [&](uint32_t a, uint32_t b) {
+				return std::less<const Mesh *>()(geometries[a].mesh, geometries[b].mesh) ||
+					   (geometries[a].mesh == geometries[b].mesh && a < b);
+			});
+			for(uint32_t i = 1; i < geometryCount; i++) {
+				if(geometries[meshOrder[i]].mesh == geometries[meshOrder[i - 1]].mesh) {
+					geometries[meshOrder[i]].updatesWorldCache = false;
 				}
+			}
 
-				// Goraud shading
-				if(m_ShadingMode == ShadingMode::GORAUD) {
-					// Directional light
-					for(int i = 0; i < vertexNormals.size(); i++){
-						Math::Vector3 normal = vertexNormals[i].normalized();
-						float dot = lightDirection.dot(normal);
-						// Convert from [-1, 1] to [0, 1] light intensity
-						dot = (1 - dot) / 2.0f;
-						vertexLightIntensities[i] = dot;
+			// Only grows, so that the streams keep their memory between frames
+			if(m_MeshClipVertices.size() < geometryCount) {
+				m_MeshClipVertices.resize(geometryCount);
+			}
+
+			// Geometry stage, in parallel over meshes and then over chunks of faces. Every
+			// thread appends to its own list, and the lists are merged in chunk order, so the
+			// triangles come out in the same order whatever the number of threads.
+			const bool parallelGeometry = numThreads > 1;
+			if(needsViewVertices || needsVertexLights) {
+				// Meshes whose transform changed since the last frame, such as animated
+				// ones, recompute their world space vertices and normals here
+				#pragma omp parallel for schedule(dynamic) if(parallelGeometry)
+				for(uint32_t geometryIndex = 0; geometryIndex < geometryCount; geometryIndex++) {
+					const MeshGeometry &geometry = geometries[geometryIndex];
+					if(geometry.updatesWorldCache) {
+						geometry.mesh->updateWorldCache(needsViewVertices, needsVertexLights);
 					}
 				}
+			}
 
-				for(const Mesh::Face &face: mesh.faces) {
-					Triangle triangle({
-							worldVertices[face.vertexIndices.x-1],
-							worldVertices[face.vertexIndices.y-1],
-							worldVertices[face.vertexIndices.z-1]
-						}, 
-						{face.texCoords[0], face.texCoords[1], face.texCoords[2]},
-						mesh.m_Materials.at(face.textureIndex).getTexture(), {}
-					);
-
-					// World space -> View space
-					triangle.points[0] = viewMatrix.mul(triangle.points[0]);
-					triangle.points[1] = viewMatrix.mul(triangle.points[1]);
-					triangle.points[2] = viewMatrix.mul(triangle.points[2]);
+			#pragma omp parallel for schedule(dynamic) if(parallelGeometry)
+			for(uint32_t geometryIndex = 0; geometryIndex < geometryCount; geometryIndex++) {
+				transformMeshVertices(geometries[geometryIndex], viewMatrix, lightDirection, m_MeshClipVertices[geometryIndex]);
+			}
 
-					// Cull triangles
-					Math::Vector3 triangleNormal = triangle.calculateNormal();
-					Math::Vector3 cameraRay = Math::Vector3::zero().sub(triangle.points[0]);
-					float dot = cameraRay.dot(triangleNormal);
+			uint32_t chunkCount = 0;
+			for(uint32_t geometryIndex = 0; geometryIndex < geometryCount; geometryIndex++) {
+				for(const Mesh::Submesh &submesh : geometries[geometryIndex].mesh->submeshes) {
+					chunkCount += (submesh.faceCount + FACE_CHUNK_SIZE - 1) / FACE_CHUNK_SIZE;
+				}
+			}
 
-					if(dot < 0)
-						continue;
-			
-					switch(m_ShadingMode) {
-						case ShadingMode::NONE:
-							triangle.vertexLights[0] = 1.0f;
-							triangle.vertexLights[1] = 1.0f;
-							triangle.vertexLights[2] = 1.0f;
-							break;
-						case ShadingMode::FLAT: {
-							// Directional light
-							Math::Vector3 lightDirection(0, 0, 1);
-							float dot = lightDirection.dot(triangle.calculateNormal());
-							// Convert from [-1, 1] to [0, 1] light intensity
-							dot = (1 - dot) / 2.0f;
-							triangle.vertexLights[0] = dot;
-							triangle.vertexLights[1] = dot;
-							triangle.vertexLights[2] = dot;
-							break;
-						}
-						case ShadingMode::GORAUD:
-							triangle.vertexLights[0] = vertexLightIntensities[face.vertexIndices.x-1];
-							triangle.vertexLights[1] = vertexLightIntensities[face.vertexIndices.y-1];
-							triangle.vertexLights[2] = vertexLightIntensities[face.vertexIndices.z-1];
-							break;
+			FaceChunk *chunks = m_FrameArena.allocate<FaceChunk>(chunkCount);
+			uint32_t chunkIndex = 0;
+			for(uint32_t geometryIndex = 0; geometryIndex < geometryCount; geometryIndex++) {
+				const Mesh &mesh = *geometries[geometryIndex].mesh;
+				for(const Mesh::Submesh &submesh : mesh.submeshes) {
+					// One material per chunk, so its texture is resolved once and stays in cache
+					const Texture &texture = mesh.m_Materials.at(submesh.material).getTexture();
+					for(uint32_t face = 0; face < submesh.faceCount; face += FACE_CHUNK_SIZE) {
+						FaceChunk &chunk = chunks[chunkIndex++];
+						chunk.geometry = geometryIndex;
+						chunk.firstFace = submesh.firstFace + face;
+						chunk.faceCount = std::min(FACE_CHUNK_SIZE, submesh.faceCount - face);
+						chunk.texture = &texture;
 					}
+				}
+			}
 
-					std::vector<Triangle> trianglesAfterClipping = clipper.clipTriangle(triangle);
-					for(Triangle &clippedTriangle: trianglesAfterClipping) {
-						for(int i = 0; i < 3; i++) {
-							Math::Vector4 projectedVertex = projectionMatrix.mul(clippedTriangle.points[i]);
-							projectedVertex = projectedVertex.perspectiveDivide();
+			const int threadCount = parallelGeometry ? omp_get_max_threads() : 1;
+			if(static_cast<int>(m_GeometryThreads.size()) < threadCount) {
+				m_GeometryThreads.resize(threadCount);
+			}
+			for(GeometryThread &thread : m_GeometryThreads) {
+				thread.triangles.clear();
+				thread.stats = Stats();
+			}
 
-							projectedVertex.x *= m_PixelBufferWidth/2.0;
-							projectedVertex.y *= -m_PixelBufferHeight/2.0;
+			#pragma omp parallel for schedule(dynamic) if(parallelGeometry)
+			for(uint32_t i = 0; i < chunkCount; i++) {
+				FaceChunk &chunk = chunks[i];
+				chunk.thread = omp_get_thread_num();
+				processFaceChunk(chunk, geometries[chunk.geometry], m_GeometryThreads[chunk.thread]);
+			}
 
-							projectedVertex.x += m_PixelBufferWidth/2.0;
-							projectedVertex.y += m_PixelBufferHeight/2.0;
+			size_t triangleCount = 0;
+			for(uint32_t i = 0; i < chunkCount; i++) {
+				triangleCount += chunks[i].triangleCount;
+			}
+			m_FrameTriangles.resize(triangleCount);
+
+			size_t nextTriangle = 0;
+			for(uint32_t i = 0; i < chunkCount; i++) {
+				const FaceChunk &chunk = chunks[i];
+				const Triangle *triangles = m_GeometryThreads[chunk.thread].triangles.data() + chunk.firstTriangle;
+				std::copy(triangles, triangles + chunk.triangleCount, m_FrameTriangles.begin() + nextTriangle);
+				nextTriangle += chunk.triangleCount;
+			}
 
-							clippedTriangle.points[i] = projectedVertex;
-						}
-						
-						float area = clippedTriangle.calculateArea2D();
-						if(area > 0) {
-							if(numThreads > 1){
-								this->drawTriangleParallel(clippedTriangle);
-							} else {
-								this->drawTriangle(clippedTriangle);
-							}
-							if(m_WireframeEnabled) {
-								this->drawTriangleWireframe(clippedTriangle, m_WireframeColor);
-							}
-						}
+			for(const GeometryThread &thread : m_GeometryThreads) {
+				m_Stats.trivialRejectedTriangles += thread.stats.trivialRejectedTriangles;
+				m_Stats.trivialAcceptedTriangles += thread.stats.trivialAcceptedTriangles;
+				m_Stats.clippedTriangles += thread.stats.clippedTriangles;
+			}
+
+			if(binned) {
+				binTriangles();
+				drawBinnedTriangles();
+			} else if(deferred) {
+				for(size_t i = 0; i < m_FrameTriangles.size(); i++) {
+					const uint32_t visibilityId = i + 1;
+					if(numThreads > 1) {
+						this->rasterizeTriangleParallel(m_FrameTriangles[i], visibilityId);
+					} else {
+						this->rasterizeTriangle(m_FrameTriangles[i], visibilityId, 0, 0, m_PixelBufferWidth - 1, m_PixelBufferHeight - 1);
 					}
 				}
+			} else {
+				for(const Triangle &triangle : m_FrameTriangles) {
+					if(numThreads > 1){
+						this->drawTriangleParallel(triangle);
+					} else {
+						this->drawTriangle(triangle);
+					}
+					if(m_WireframeEnabled) {
+						this->drawTriangleWireframe(triangle, m_WireframeColor);
+					}
+				}
+			}
+
+			if(deferred) {
+				resolveVisibilityBuffer();
+			}
+			m_Stats.frameArenaBytes = m_FrameArena.getHighWaterMark();
+
+			if(collected && m_WireframeEnabled) {
+				for(const Triangle &triangle : m_FrameTriangles) {
+					this->drawTriangleWireframe(triangle, m_WireframeColor);
+				}
 			}
 
 			SDL_UpdateTexture(
@@ -206,6 +371,288 @@ namespace Hiruki {
 			);
 		}
 
+		void RenderPipeline::transformMeshVertices(MeshGeometry &geometry, const Math::Matrix4 &viewMatrix,
+												   const Math::Vector3 &lightDirection, Math::Vector4Stream &clipVertices) const {
+			// Post-transform buffers: every vertex is transformed once, by the combined
+			// matrix, and the faces only index them. Outcodes are computed once per vertex
+			// too, so triangles only combine them for the trivial accept and reject tests.
+
+			// Object space -> Clip space, several vertices at a time
+			geometry.modelViewProjectionMatrix.transformPoints(geometry.mesh->vertexStream, clipVertices);
+			geometry.clipVertices = &clipVertices;
+			for(size_t i = 0; i < clipVertices.size(); i++) {
+				const Math::Vector4 clipVertex = clipVertices[i];
+				const uint8_t outcode = Clipping::computeOutcode(clipVertex);
+
+				geometry.vertexOutcodes[i] = outcode;
+				// Only the sides move out with the guard band, and the points inside
+				// the view are inside it too
+				geometry.vertexClipOutcodes[i] = m_GuardBandEnabled && outcode != 0
+					? Clipping::computeOutcode(clipVertex, GUARD_BAND_SCALE)
+					: outcode;
+			}
+
+			// The caches are already up to date, the getters only read them
+			geometry.worldVertices = geometry.viewVertices ? &geometry.mesh->getWorldVertices() : nullptr;
+			geometry.worldNormals = geometry.vertexLights ? &geometry.mesh->getWorldNormals() : nullptr;
+
+			if(geometry.viewVertices) {
+				const std::vector<Math::Vector3> &worldVertices = *geometry.worldVertices;
+				for(size_t i = 0; i < worldVertices.size(); i++) {
+					// World space -> View space
+					geometry.viewVertices[i] = viewMatrix.mul(worldVertices[i]);
+				}
+			}
+
+			// Goraud shading
+			if(geometry.vertexLights) {
+				// Directional light
+				const std::vector<Math::Vector3> &worldNormals = *geometry.worldNormals;
+				for(size_t i = 0; i < worldNormals.size(); i++){
+					const Math::Vector3 &normal = worldNormals[i];
+					float dot = lightDirection.dot(normal);
+					// Convert from [-1, 1] to [0, 1] light intensity
+					dot = (1 - dot) / 2.0f;
+					geometry.vertexLights[i] = dot;
+				}
+			}
+		}
+
+		void RenderPipeline::processFaceChunk(FaceChunk &chunk, const MeshGeometry &geometry, GeometryThread &thread) const {
+			const Mesh &mesh = *geometry.mesh;
+			const Math::Vector4Stream &clipVertices = *geometry.clipVertices;
+			const uint8_t *vertexOutcodes = geometry.vertexOutcodes;
+			const uint8_t *vertexClipOutcodes = geometry.vertexClipOutcodes;
+			const Math::Vector4 *viewVertices = geometry.viewVertices;
+			const float *vertexLightIntensities = geometry.vertexLights;
+			const bool clipSpace = m_ClippingMode == ClippingMode::CLIP_SPACE;
+			std::vector<Triangle> &clippedTriangles = thread.clippedTriangles;
+
+			chunk.firstTriangle = thread.triangles.size();
+			for(size_t face = chunk.firstFace; face < chunk.firstFace + chunk.faceCount; face++) {
+				const size_t corner = face * 3;
+				const uint32_t index0 = mesh.indices[corner];
+				const uint32_t index1 = mesh.indices[corner + 1];
+				const uint32_t index2 = mesh.indices[corner + 2];
+
+				// Triangles with all their points outside a plane of the view are never visible
+				if(vertexOutcodes[index0] & vertexOutcodes[index1] & vertexOutcodes[index2]) {
+					thread.stats.trivialRejectedTriangles++;
+					continue;
+				}
+
+				const Math::Vector4 clip0 = clipVertices[index0];
+				const Math::Vector4 clip1 = clipVertices[index1];
+				const Math::Vector4 clip2 = clipVertices[index2];
+
+				// Cull back faces. The determinant of the (x, y, w) clip coordinates is the volume
+				// spanned by the camera and the triangle in view space, scaled by the (positive)
+				// x and y factors of the projection, so it has the same sign as the view space
+				// facing test, and needs no divide even for points behind the camera. Computed
+				// in double, so that nearly edge-on triangles keep the right sign.
+				const double x0 = clip0.x, y0 = clip0.y, w0 = clip0.w;
+				const double x1 = clip1.x, y1 = clip1.y, w1 = clip1.w;
+				const double x2 = clip2.x, y2 = clip2.y, w2 = clip2.w;
+				const double facing =
+					x0 * (y1 * w2 - w1 * y2) -
+					y0 * (x1 * w2 - w1 * x2) +
+					w0 * (x1 * y2 - y1 * x2);
+				if(facing < 0)
+					continue;
+
+				Triangle triangle({clip0, clip1, clip2},
+					{
+						mesh.texCoords[mesh.texCoordIndices[corner]],
+						mesh.texCoords[mesh.texCoordIndices[corner + 1]],
+						mesh.texCoords[mesh.texCoordIndices[corner + 2]]
+					},
+					*chunk.texture, {}
+				);
+		
+				switch(m_ShadingMode) {
+					case ShadingMode::NONE:
+						triangle.vertexLights[0] = 1.0f;
+						triangle.vertexLights[1] = 1.0f;
+						triangle.vertexLights[2] = 1.0f;
+						break;
+					case ShadingMode::FLAT: {
+						// Directional light, in view space
+						const Triangle viewTriangle({viewVertices[index0], viewVertices[index1], viewVertices[index2]});
+						Math::Vector3 lightDirection(0, 0, 1);
+						float dot = lightDirection.dot(viewTriangle.calculateNormal());
+						// Convert from [-1, 1] to [0, 1] light intensity
+						dot = (1 - dot) / 2.0f;
+						triangle.vertexLights[0] = dot;
+						triangle.vertexLights[1] = dot;
+						triangle.vertexLights[2] = dot;
+						break;
+					}
+					case ShadingMode::GORAUD:
+						triangle.vertexLights[0] = vertexLightIntensities[mesh.normalIndices[corner]];
+						triangle.vertexLights[1] = vertexLightIntensities[mesh.normalIndices[corner + 1]];
+						triangle.vertexLights[2] = vertexLightIntensities[mesh.normalIndices[corner + 2]];
+						break;
+				}
+
+				const uint8_t clipOutcode = vertexClipOutcodes[index0] | vertexClipOutcodes[index1] | vertexClipOutcodes[index2];
+				if(clipOutcode == 0) {
+					thread.stats.trivialAcceptedTriangles++;
+
+					clippedTriangles.clear();
+					clippedTriangles.push_back(triangle);
+				} else if(clipSpace) {
+					thread.stats.clippedTriangles++;
+
+					m_Clipper.clipTriangleHomogeneous(triangle, clipOutcode, clippedTriangles, m_GuardBandEnabled);
+				} else {
+					thread.stats.clippedTriangles++;
+
+					triangle.points = {viewVertices[index0], viewVertices[index1], viewVertices[index2]};
+					m_Clipper.clipTriangle(triangle, clippedTriangles, m_GuardBandEnabled);
+					// View space -> Clip space
+					for(Triangle &clippedTriangle: clippedTriangles) {
+						for(int i = 0; i < 3; i++) {
+							clippedTriangle.points[i] = m_ProjectionMatrix.mul(clippedTriangle.points[i]);
+						}
+					}
+				}
+
+				for(Triangle &clippedTriangle: clippedTriangles) {
+					for(int i = 0; i < 3; i++) {
+						Math::Vector4 projectedVertex = clippedTriangle.points[i].perspectiveDivide();
+
+						projectedVertex.x *= m_PixelBufferWidth/2.0;
+						projectedVertex.y *= -m_PixelBufferHeight/2.0;
+
+						projectedVertex.x += m_PixelBufferWidth/2.0;
+						projectedVertex.y += m_PixelBufferHeight/2.0;
+
+						clippedTriangle.points[i] = projectedVertex;
+					}
+					
+					if(clippedTriangle.calculateArea2D() > 0) {
+						thread.triangles.push_back(clippedTriangle);
+					}
+				}
+			}
+			chunk.triangleCount = thread.triangles.size() - chunk.firstTriangle;
+		}
+
+		// Triangle with its vertices snapped to SUBPIXEL_BITS fixed-point, along
+		// with the range of pixels whose center might be covered by it.
+		struct FixedTriangle {
+			int64_t x0, y0;
+			int64_t x1, y1;
+			int64_t x2, y2;
+
+			int minX, minY;
+			int maxX, maxY;
+		};
+
+		static FixedTriangle snapTriangle(const Triangle &triangle) {
+			const Math::Vector4 &v0 = triangle.points[0];
+			const Math::Vector4 &v1 = triangle.points[1];
+			const Math::Vector4 &v2 = triangle.points[2];
+
+			const float scale = RenderPipeline::SUBPIXEL_SCALE;
+			const int64_t halfPixel = RenderPipeline::SUBPIXEL_SCALE / 2;
+
+			FixedTriangle fixed;
+			fixed.x0 = std::llround(v0.x * scale);
+			fixed.y0 = std::llround(v0.y * scale);
+			fixed.x1 = std::llround(v1.x * scale);
+			fixed.y1 = std::llround(v1.y * scale);
+			fixed.x2 = std::llround(v2.x * scale);
+			fixed.y2 = std::llround(v2.y * scale);
+
+			// Pixels are sampled at their centers, so the first pixel is the one whose
+			// center is at or after the minimum, and the last one the one whose center
+			// is at or before the maximum.
+			int64_t minX = std::min(fixed.x0, std::min(fixed.x1, fixed.x2));
+			int64_t minY = std::min(fixed.y0, std::min(fixed.y1, fixed.y2));
+			int64_t maxX = std::max(fixed.x0, std::max(fixed.x1, fixed.x2));
+			int64_t maxY = std::max(fixed.y0, std::max(fixed.y1, fixed.y2));
+
+			fixed.minX = (minX - halfPixel + RenderPipeline::SUBPIXEL_SCALE - 1) >> RenderPipeline::SUBPIXEL_BITS;
+			fixed.minY = (minY - halfPixel + RenderPipeline::SUBPIXEL_SCALE - 1) >> RenderPipeline::SUBPIXEL_BITS;
+			fixed.maxX = (maxX - halfPixel) >> RenderPipeline::SUBPIXEL_BITS;
+			fixed.maxY = (maxY - halfPixel) >> RenderPipeline::SUBPIXEL_BITS;
+
+			return fixed;
+		}
+
+		void RenderPipeline::binTriangles() {
+			const int tileCount = m_TileCountX * m_TileCountY;
+			const size_t triangleCount = m_FrameTriangles.size();
+
+			// Tiles touched by each triangle, counted into the bins first so that
+			// every bin can be laid out one after the other in a single array
+			class TileRange {
+				public:
+					int minTileX, minTileY, maxTileX, maxTileY;
+			};
+			TileRange *ranges = m_FrameArena.allocate<TileRange>(triangleCount);
+			uint32_t *binEnds = m_FrameArena.allocate<uint32_t>(tileCount);
+			std::fill(binEnds, binEnds + tileCount, 0);
+
+			for(size_t i = 0; i < triangleCount; i++) {
+				// Same bounding box as the one walked by drawTriangle
+				FixedTriangle fixed = snapTriangle(m_FrameTriangles[i]);
+
+				TileRange &range = ranges[i];
+				range.minTileX = std::max(0, fixed.minX / TILE_SIZE);
+				range.minTileY = std::max(0, fixed.minY / TILE_SIZE);
+				range.maxTileX = std::min(m_TileCountX - 1, fixed.maxX / TILE_SIZE);
+				range.maxTileY = std::min(m_TileCountY - 1, fixed.maxY / TILE_SIZE);
+
+				for(int tileY = range.minTileY; tileY <= range.maxTileY; tileY++) {
+					for(int tileX = range.minTileX; tileX <= range.maxTileX; tileX++) {
+						binEnds[tileY * m_TileCountX + tileX]++;
+					}
+				}
+			}
+
+			m_TileBinStarts = m_FrameArena.allocate<uint32_t>(tileCount + 1);
+			m_TileBinStarts[0] = 0;
+			for(int tile = 0; tile < tileCount; tile++) {
+				m_TileBinStarts[tile + 1] = m_TileBinStarts[tile] + binEnds[tile];
+				binEnds[tile] = m_TileBinStarts[tile];
+			}
+
+			// In submission order within each bin
+			m_TileBinTriangles = m_FrameArena.allocate<uint32_t>(m_TileBinStarts[tileCount]);
+			for(size_t i = 0; i < triangleCount; i++) {
+				const TileRange &range = ranges[i];
+				for(int tileY = range.minTileY; tileY <= range.maxTileY; tileY++) {
+					for(int tileX = range.minTileX; tileX <= range.maxTileX; tileX++) {
+						m_TileBinTriangles[binEnds[tileY * m_TileCountX + tileX]++] = i;
+					}
+				}
+			}
+		}
+
+		void RenderPipeline::drawBinnedTriangles() {
+			const int tileCount = m_TileCountX * m_TileCountY;
+
+			// Each tile (and therefore its color and depth) is owned by a single
+			// thread, so no synchronization is needed between tiles.
+			#pragma omp parallel for schedule(dynamic)
+			for(int tileIndex = 0; tileIndex < tileCount; tileIndex++) {
+				const int minX = (tileIndex % m_TileCountX) * TILE_SIZE;
+				const int minY = (tileIndex / m_TileCountX) * TILE_SIZE;
+				const int maxX = std::min(minX + TILE_SIZE, m_PixelBufferWidth) - 1;
+				const int maxY = std::min(minY + TILE_SIZE, m_PixelBufferHeight) - 1;
+
+				for(uint32_t bin = m_TileBinStarts[tileIndex]; bin < m_TileBinStarts[tileIndex + 1]; bin++) {
+					const uint32_t triangleIndex = m_TileBinTriangles[bin];
+					// Triangle IDs of the visibility buffer start at 1, 0 is an empty pixel
+					const uint32_t visibilityId = m_VisibilityBufferEnabled ? triangleIndex + 1 : 0;
+					this->rasterizeTriangle(m_FrameTriangles[triangleIndex], visibilityId, minX, minY, maxX, maxY);
+				}
+			}
+		}
+
+
 		uint32_t colorPercent(uint32_t color, float percent) {
 			uint8_t red = (color >> 24) & 0xFF;
 			uint8_t green = (color >> 16) & 0xFF;
@@ -220,6 +667,822 @@ namespace Hiruki {
 			return (red << 24) | (green << 16) | (blue << 8) | alpha;
 		}
 
+		// Edge function of the edge a -> b evaluated at p, all in fixed-point.
+		// Positive on the inside of counter-clockwise triangles.
+		static inline int64_t edgeFunction(int64_t ax, int64_t ay, int64_t bx, int64_t by, int64_t px, int64_t py) {
+			return (px - ax) * (by - ay) - (py - ay) * (bx - ax);
+		}
+
+		// Top-left fill rule: pixel centers lying exactly on an edge are only
+		// drawn if it is a top edge (horizontal, with the triangle below it) or a
+		// left edge (the triangle is to its right), so pixels on edges shared by
+		// two triangles are drawn exactly once.
+		static inline bool isTopLeftEdge(int64_t ax, int64_t ay, int64_t bx, int64_t by) {
+			return (by - ay) > 0 || ((by - ay) == 0 && (bx - ax) < 0);
+		}
+
+		// An attribute that varies linearly in screen space, as a function of
+		// the offset (in pixels) from the origin pixel of the triangle setup.
+		struct AttributePlane {
+			float origin = 0;
+			float stepX = 0, stepY = 0;
+
+			// Value at the first pixel of a row, offsetY rows below the origin
+			inline float rowValue(float offsetY) const { return origin + stepY * offsetY; }
+		};
+
+		// Per-triangle constants shared by every span (row) of a triangle.
+		// Everything that does not depend on the pixel is hoisted here.
+		struct SpanSetup {
+			const Triangle *triangle = nullptr;
+
+			// Edge functions at the center of pixel (originX, originY), with the
+			// top-left bias already applied
+			int originX = 0, originY = 0;
+			int64_t originE0 = 0, originE1 = 0, originE2 = 0;
+
+			// Edge function increments when moving one pixel right or down
+			int64_t colStepE0 = 0, colStepE1 = 0, colStepE2 = 0;
+			int64_t rowStepE0 = 0, rowStepE1 = 0, rowStepE2 = 0;
+			float areaRecip = 0;
+
+			// 1/w, u/w and v/w are linear in screen space, and so is the light
+			// across a Goraud shaded triangle
+			AttributePlane wRecip = {}, texU = {}, texV = {}, light = {};
+			// Upper bound of the float rounding error of wRecip, and the largest
+			// 1/w (nearest depth) of the triangle, with that error included
+			float wRecipError = 0;
+			float nearestWRecip = 0;
+
+			// Light of the whole triangle when flat shaded, and color of the whole
+			// triangle when it is solid and not Goraud shaded
+			float flatLight = 1;
+			uint32_t flatColor = 0;
+		};
+
+		static SpanSetup makeSpanSetup(const Triangle &triangle, RenderPipeline::DrawMode drawMode,
+									   RenderPipeline::ShadingMode shadingMode,
+									   const FixedTriangle &fixed, int64_t area, int originX, int originY) {
+			const Math::Vector4 &v0 = triangle.points[0];
+			const Math::Vector4 &v1 = triangle.points[1];
+			const Math::Vector4 &v2 = triangle.points[2];
+
+			const TexCoord &t0 = triangle.texCoords[0];
+			const TexCoord &t1 = triangle.texCoords[1];
+			const TexCoord &t2 = triangle.texCoords[2];
+
+			SpanSetup setup = {&triangle};
+
+			// Center of the origin pixel
+			const int64_t pointX = (static_cast<int64_t>(originX) << RenderPipeline::SUBPIXEL_BITS) + RenderPipeline::SUBPIXEL_SCALE / 2;
+			const int64_t pointY = (static_cast<int64_t>(originY) << RenderPipeline::SUBPIXEL_BITS) + RenderPipeline::SUBPIXEL_SCALE / 2;
+
+			const int64_t e0 = edgeFunction(fixed.x1, fixed.y1, fixed.x2, fixed.y2, pointX, pointY);
+			const int64_t e1 = edgeFunction(fixed.x2, fixed.y2, fixed.x0, fixed.y0, pointX, pointY);
+			const int64_t e2 = edgeFunction(fixed.x0, fixed.y0, fixed.x1, fixed.y1, pointX, pointY);
+
+			// Biased so that non top-left edges exclude the pixels lying on them
+			setup.originX = originX;
+			setup.originY = originY;
+			setup.originE0 = e0 - (isTopLeftEdge(fixed.x1, fixed.y1, fixed.x2, fixed.y2) ? 0 : 1);
+			setup.originE1 = e1 - (isTopLeftEdge(fixed.x2, fixed.y2, fixed.x0, fixed.y0) ? 0 : 1);
+			setup.originE2 = e2 - (isTopLeftEdge(fixed.x0, fixed.y0, fixed.x1, fixed.y1) ? 0 : 1);
+
+			setup.colStepE0 = (fixed.y2 - fixed.y1) * RenderPipeline::SUBPIXEL_SCALE;
+			setup.colStepE1 = (fixed.y0 - fixed.y2) * RenderPipeline::SUBPIXEL_SCALE;
+			setup.colStepE2 = (fixed.y1 - fixed.y0) * RenderPipeline::SUBPIXEL_SCALE;
+
+			setup.rowStepE0 = (fixed.x1 - fixed.x2) * RenderPipeline::SUBPIXEL_SCALE;
+			setup.rowStepE1 = (fixed.x2 - fixed.x0) * RenderPipeline::SUBPIXEL_SCALE;
+			setup.rowStepE2 = (fixed.x0 - fixed.x1) * RenderPipeline::SUBPIXEL_SCALE;
+
+			setup.areaRecip = 1 / static_cast<float>(area);
+
+			// Interpolating the vertex values a0..a2 with the barycentric weights
+			// e0..e2 / area is the same as evaluating a plane, whose value and
+			// gradients are computed once here
+			const double areaRecip = 1 / static_cast<double>(area);
+			auto makePlane = [&](double a0, double a1, double a2) {
+				AttributePlane plane;
+				plane.origin = static_cast<float>((a0 * e0 + a1 * e1 + a2 * e2) * areaRecip);
+				plane.stepX = static_cast<float>((a0 * setup.colStepE0 + a1 * setup.colStepE1 + a2 * setup.colStepE2) * areaRecip);
+				plane.stepY = static_cast<float>((a0 * setup.rowStepE0 + a1 * setup.rowStepE1 + a2 * setup.rowStepE2) * areaRecip);
+				return plane;
+			};
+
+			const double wRecip0 = 1 / static_cast<double>(v0.w);
+			const double wRecip1 = 1 / static_cast<double>(v1.w);
+			const double wRecip2 = 1 / static_cast<double>(v2.w);
+
+			setup.wRecip = makePlane(wRecip0, wRecip1, wRecip2);
+
+			// Pixels are evaluated as origin + stepY * offsetY + stepX * offsetX, with
+			// offsets up to the size of the bounding box. A few ulps of its terms
+			// bound both this and the rounding of the plane to floats.
+			const float maxOffsetX = static_cast<float>(std::max(fixed.maxX - originX, 0));
+			const float maxOffsetY = static_cast<float>(std::max(fixed.maxY - originY, 0));
+			setup.wRecipError = 8 * FLT_EPSILON * (std::fabs(setup.wRecip.origin) +
+												   std::fabs(setup.wRecip.stepX) * maxOffsetX +
+												   std::fabs(setup.wRecip.stepY) * maxOffsetY);
+			setup.nearestWRecip = static_cast<float>(std::max(wRecip0, std::max(wRecip1, wRecip2))) + setup.wRecipError;
+			if(drawMode == RenderPipeline::DrawMode::TEXTURED) {
+				setup.texU = makePlane(t0.u * wRecip0, t1.u * wRecip1, t2.u * wRecip2);
+				setup.texV = makePlane(t0.v * wRecip0, t1.v * wRecip1, t2.v * wRecip2);
+			}
+			if(shadingMode == RenderPipeline::ShadingMode::GORAUD) {
+				setup.light = makePlane(triangle.vertexLights[0], triangle.vertexLights[1], triangle.vertexLights[2]);
+			}
+
+			setup.flatLight = std::max(0.0f, std::min(1.0f, triangle.vertexLights[0]));
+			setup.flatColor = triangle.color;
+			if(drawMode == RenderPipeline::DrawMode::SOLID && shadingMode == RenderPipeline::ShadingMode::FLAT) {
+				setup.flatColor = colorPercent(triangle.color, setup.flatLight);
+			}
+
+			return setup;
+		}
+
+		// Compile-time configuration of the raster kernels. Every combination is
+		// instantiated separately, so the work a combination does not need (e.g.
+		// interpolating lights with ShadingMode::NONE) is not in its inner loop.
+		template<RenderPipeline::RasterKernel Kernel, RenderPipeline::DrawMode Mode,
+				 RenderPipeline::ShadingMode Shading, bool DepthTest, bool DepthWrite>
+		struct RasterConfig {
+			static constexpr RenderPipeline::RasterKernel kernel = Kernel;
+			static constexpr RenderPipeline::DrawMode drawMode = Mode;
+			static constexpr RenderPipeline::ShadingMode shadingMode = Shading;
+			static constexpr bool depthTest = DepthTest;
+			static constexpr bool depthWrite = DepthWrite;
+
+			static constexpr bool needsTexCoords = Mode == RenderPipeline::DrawMode::TEXTURED;
+			static constexpr bool needsLight = Shading == RenderPipeline::ShadingMode::GORAUD;
+			// The same color for every pixel, already known at setup
+			static constexpr bool flatColor = Mode == RenderPipeline::DrawMode::SOLID &&
+											  Shading != RenderPipeline::ShadingMode::GORAUD;
+		};
+
+		// Final color of a covered pixel.
+		template<typename Config>
+		static inline uint32_t shadePixel(const SpanSetup &setup, float alpha, float beta, float gamma,
+										  float uInterpolated, float vInterpolated, float lightIntensity) {
+			uint32_t color = 0;
+			if constexpr(Config::drawMode == RenderPipeline::DrawMode::SOLID) {
+				color = setup.triangle->color;
+			} else if constexpr(Config::drawMode == RenderPipeline::DrawMode::GRADIENT) {
+				color = colorPercent(0xFF0000FF, alpha) +
+						colorPercent(0x00FF00FF, beta) +
+						colorPercent(0x0000FF00, gamma);
+			} else {
+				color = setup.triangle->texture->pickColor(uInterpolated, vInterpolated);
+			}
+
+			if constexpr(Config::shadingMode == RenderPipeline::ShadingMode::NONE) {
+				return color;
+			} else if constexpr(Config::shadingMode == RenderPipeline::ShadingMode::FLAT) {
+				return colorPercent(color, setup.flatLight);
+			} else {
+				return colorPercent(color, lightIntensity);
+			}
+		}
+
+		// Color of a covered pixel, from its edge functions and the attribute
+		// planes of the triangle. Shared by the scalar kernel and the visibility
+		// buffer resolve, so that both shade a pixel exactly alike.
+		template<typename Config>
+		static inline uint32_t shadePlanePixel(const SpanSetup &setup, float offsetX, float wInterpolated,
+											   float rowU, float rowV, float rowLight,
+											   int64_t e0, int64_t e1, int64_t e2) {
+			if constexpr(Config::flatColor) {
+				return setup.flatColor;
+			}
+
+			float alpha = 0, beta = 0, gamma = 0;
+			if constexpr(Config::drawMode == RenderPipeline::DrawMode::GRADIENT) {
+				alpha = static_cast<float>(e0) * setup.areaRecip;
+				beta = static_cast<float>(e1) * setup.areaRecip;
+				gamma = static_cast<float>(e2) * setup.areaRecip;
+			}
+
+			float lightIntensity = 1;
+			if constexpr(Config::needsLight) {
+				lightIntensity = rowLight + setup.light.stepX * offsetX;
+				lightIntensity = std::max(0.0f, std::min(1.0f, lightIntensity));
+			}
+
+			// A single reciprocal per pixel for the perspective correction
+			float uInterpolated = 0, vInterpolated = 0;
+			if constexpr(Config::needsTexCoords) {
+				float wInverse = 1.0f / wInterpolated;
+				uInterpolated = (rowU + setup.texU.stepX * offsetX) * wInverse;
+				vInterpolated = (rowV + setup.texV.stepX * offsetX) * wInverse;
+			}
+
+			return shadePixel<Config>(setup, alpha, beta, gamma, uInterpolated, vInterpolated, lightIntensity);
+		}
+
+		// rowE0..2 are the edge functions at the center of pixel originX, with the
+		// top-left bias already applied, so a pixel is covered when none of them
+		// is negative. Edge functions are integers, so every kernel computes
+		// exactly the same coverage.
+		// Attributes are evaluated from their planes as rowValue + stepX * offsetX,
+		// with the same float operations in every kernel, so they match too.
+		// Spans of blocks known to be fully inside the triangle skip the coverage test.
+		// Returns the amount of covered pixels that failed the depth test.
+		template<typename Config, bool TestCoverage>
+		static uint64_t drawSpanScalar(const SpanSetup &setup, int originX, int minX, int maxX, int y,
+								   int64_t rowE0, int64_t rowE1, int64_t rowE2,
+								   uint32_t *pixelRow, float *depthRow) {
+			const float offsetY = static_cast<float>(y - setup.originY);
+			const float rowW = setup.wRecip.rowValue(offsetY);
+			const float rowU = setup.texU.rowValue(offsetY);
+			const float rowV = setup.texV.rowValue(offsetY);
+			const float rowLight = setup.light.rowValue(offsetY);
+
+			uint64_t occludedPixels = 0;
+			for(int x = minX; x <= maxX; x++) {
+				int64_t dx = x - originX;
+
+				int64_t e0 = rowE0 + setup.colStepE0 * dx;
+				int64_t e1 = rowE1 + setup.colStepE1 * dx;
+				int64_t e2 = rowE2 + setup.colStepE2 * dx;
+
+				if(!TestCoverage || (e0 | e1 | e2) >= 0) {
+					const float offsetX = static_cast<float>(x - setup.originX);
+					float wInterpolated = rowW + setup.wRecip.stepX * offsetX;
+
+					// Early depth test, occluded pixels are neither shaded nor textured
+					float depth = 1 - wInterpolated;
+					if constexpr(Config::depthTest) {
+						if(!(depth < depthRow[x])) {
+							occludedPixels++;
+							continue;
+						}
+					}
+
+					pixelRow[x] = shadePlanePixel<Config>(setup, offsetX, wInterpolated, rowU, rowV, rowLight, e0, e1, e2);
+					if constexpr(Config::depthWrite) {
+						depthRow[x] = depth;
+					}
+				}
+			}
+
+			return occludedPixels;
+		}
+
+#ifdef HIRUKI_RASTER_SIMD
+		// Converts two pairs of int64 lanes to 4 floats. Exact for |x| < 2^51,
+		// which edge functions always are, as x is added to the mantissa of 1.5 * 2^52.
+		static inline __m128 int64ToFloatSSE(__m128i low, __m128i high) {
+			const __m128d magic = _mm_set1_pd(6755399441055744.0);
+			__m128d lowDouble = _mm_sub_pd(_mm_castsi128_pd(_mm_add_epi64(low, _mm_castpd_si128(magic))), magic);
+			__m128d highDouble = _mm_sub_pd(_mm_castsi128_pd(_mm_add_epi64(high, _mm_castpd_si128(magic))), magic);
+			return _mm_movelh_ps(_mm_cvtpd_ps(lowDouble), _mm_cvtpd_ps(highDouble));
+		}
+
+		// 4 pixels per step. SSE2 is part of the x86-64 baseline, so no
+		// runtime check is needed for it.
+		template<typename Config, bool TestCoverage>
+		static uint64_t drawSpanSSE(const SpanSetup &setup, int originX, int minX, int maxX, int y,
+								int64_t rowE0, int64_t rowE1, int64_t rowE2,
+								uint32_t *pixelRow, float *depthRow) {
+			const float offsetY = static_cast<float>(y - setup.originY);
+			const __m128 rowW = _mm_set1_ps(setup.wRecip.rowValue(offsetY));
+			const __m128 rowU = _mm_set1_ps(setup.texU.rowValue(offsetY));
+			const __m128 rowV = _mm_set1_ps(setup.texV.rowValue(offsetY));
+			const __m128 rowLight = _mm_set1_ps(setup.light.rowValue(offsetY));
+			const __m128 laneOffsets = _mm_setr_ps(0, 1, 2, 3);
+
+			const __m128 zero = _mm_setzero_ps();
+			const __m128 one = _mm_set1_ps(1.0f);
+			uint64_t occludedPixels = 0;
+			const __m128i laneBits = _mm_setr_epi32(1, 2, 4, 8);
+
+			int x = minX;
+			for(; x + 3 <= maxX; x += 4) {
+				int64_t dx = x - originX;
+				int64_t e0 = rowE0 + setup.colStepE0 * dx;
+				int64_t e1 = rowE1 + setup.colStepE1 * dx;
+				int64_t e2 = rowE2 + setup.colStepE2 * dx;
+
+				// Lanes 0-1 and 2-3 of each edge function
+				__m128i e0Low = _mm_set_epi64x(e0 + setup.colStepE0, e0);
+				__m128i e1Low = _mm_set_epi64x(e1 + setup.colStepE1, e1);
+				__m128i e2Low = _mm_set_epi64x(e2 + setup.colStepE2, e2);
+				__m128i e0High = _mm_add_epi64(e0Low, _mm_set1_epi64x(setup.colStepE0 * 2));
+				__m128i e1High = _mm_add_epi64(e1Low, _mm_set1_epi64x(setup.colStepE1 * 2));
+				__m128i e2High = _mm_add_epi64(e2Low, _mm_set1_epi64x(setup.colStepE2 * 2));
+
+				int coveredMask = 0xF;
+				if constexpr(TestCoverage) {
+					// The sign bit of (e0 | e1 | e2) is set when the pixel is outside
+					__m128i signsLow = _mm_or_si128(e0Low, _mm_or_si128(e1Low, e2Low));
+					__m128i signsHigh = _mm_or_si128(e0High, _mm_or_si128(e1High, e2High));
+					int outsideMask = _mm_movemask_pd(_mm_castsi128_pd(signsLow)) |
+									  (_mm_movemask_pd(_mm_castsi128_pd(signsHigh)) << 2);
+					coveredMask &= ~outsideMask;
+					if(coveredMask == 0)
+						continue;
+				}
+
+				__m128i coveredBits = _mm_and_si128(_mm_set1_epi32(coveredMask), laneBits);
+				__m128 covered = _mm_castsi128_ps(_mm_cmpeq_epi32(coveredBits, laneBits));
+
+				__m128 offsetX = _mm_add_ps(_mm_set1_ps(static_cast<float>(x - setup.originX)), laneOffsets);
+				__m128 wInterpolated = _mm_add_ps(rowW, _mm_mul_ps(_mm_set1_ps(setup.wRecip.stepX), offsetX));
+
+				// Early depth test, only the lanes that pass it are shaded and textured
+				__m128 depth = _mm_sub_ps(one, wInterpolated);
+				__m128 pass = covered;
+				int passMask = coveredMask;
+				__m128 oldDepth = zero;
+				if constexpr(Config::depthTest || Config::depthWrite) {
+					oldDepth = _mm_loadu_ps(depthRow + x);
+				}
+				if constexpr(Config::depthTest) {
+					pass = _mm_and_ps(pass, _mm_cmplt_ps(depth, oldDepth));
+					passMask = _mm_movemask_ps(pass);
+					occludedPixels += __builtin_popcount(coveredMask & ~passMask);
+					if(passMask == 0)
+						continue;
+				}
+
+				__m128i newPixels = _mm_set1_epi32(setup.flatColor);
+				if constexpr(!Config::flatColor) {
+					alignas(16) float alphas[4] = {}, betas[4] = {}, gammas[4] = {};
+					alignas(16) float us[4] = {}, vs[4] = {}, lights[4] = {};
+					alignas(16) uint32_t colors[4] = {};
+
+					if constexpr(Config::drawMode == RenderPipeline::DrawMode::GRADIENT) {
+						__m128 areaRecip = _mm_set1_ps(setup.areaRecip);
+						_mm_store_ps(alphas, _mm_mul_ps(int64ToFloatSSE(e0Low, e0High), areaRecip));
+						_mm_store_ps(betas, _mm_mul_ps(int64ToFloatSSE(e1Low, e1High), areaRecip));
+						_mm_store_ps(gammas, _mm_mul_ps(int64ToFloatSSE(e2Low, e2High), areaRecip));
+					}
+
+					if constexpr(Config::needsLight) {
+						__m128 lightIntensity = _mm_add_ps(rowLight, _mm_mul_ps(_mm_set1_ps(setup.light.stepX), offsetX));
+						lightIntensity = _mm_max_ps(_mm_min_ps(lightIntensity, one), zero);
+						_mm_store_ps(lights, lightIntensity);
+					}
+
+					if constexpr(Config::needsTexCoords) {
+						__m128 wInverse = _mm_div_ps(one, wInterpolated);
+						__m128 uInterpolated = _mm_add_ps(rowU, _mm_mul_ps(_mm_set1_ps(setup.texU.stepX), offsetX));
+						__m128 vInterpolated = _mm_add_ps(rowV, _mm_mul_ps(_mm_set1_ps(setup.texV.stepX), offsetX));
+						_mm_store_ps(us, _mm_mul_ps(uInterpolated, wInverse));
+						_mm_store_ps(vs, _mm_mul_ps(vInterpolated, wInverse));
+					}
+
+					// Texture fetches and color packing are done per lane
+					for(int lane = 0; lane < 4; lane++) {
+						if(passMask & (1 << lane)) {
+							colors[lane] = shadePixel<Config>(setup, alphas[lane], betas[lane], gammas[lane],
+															  us[lane], vs[lane], lights[lane]);
+						}
+					}
+
+					newPixels = _mm_load_si128(reinterpret_cast<const __m128i *>(colors));
+				}
+
+				// Masked stores of the covered pixels that pass the depth test
+				if constexpr(Config::depthWrite) {
+					_mm_storeu_ps(depthRow + x, _mm_or_ps(_mm_and_ps(pass, depth), _mm_andnot_ps(pass, oldDepth)));
+				}
+
+				__m128i passPixels = _mm_castps_si128(pass);
+				__m128i oldPixels = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pixelRow + x));
+				_mm_storeu_si128(reinterpret_cast<__m128i *>(pixelRow + x),
+								 _mm_or_si128(_mm_and_si128(passPixels, newPixels), _mm_andnot_si128(passPixels, oldPixels)));
+			}
+
+			occludedPixels += drawSpanScalar<Config, TestCoverage>(setup, originX, x, maxX, y, rowE0, rowE1, rowE2, pixelRow, depthRow);
+			return occludedPixels;
+		}
+
+		// Same as int64ToFloatSSE, for two groups of 4 int64 lanes.
+		__attribute__((target("avx2")))
+		static inline __m256 int64ToFloatAVX2(__m256i low, __m256i high) {
+			const __m256d magic = _mm256_set1_pd(6755399441055744.0);
+			__m256d lowDouble = _mm256_sub_pd(_mm256_castsi256_pd(_mm256_add_epi64(low, _mm256_castpd_si256(magic))), magic);
+			__m256d highDouble = _mm256_sub_pd(_mm256_castsi256_pd(_mm256_add_epi64(high, _mm256_castpd_si256(magic))), magic);
+			return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm256_cvtpd_ps(lowDouble)), _mm256_cvtpd_ps(highDouble), 1);
+		}
+
+		// 8 pixels per step. Only called when the CPU reports AVX2 support.
+		template<typename Config, bool TestCoverage>
+		__attribute__((target("avx2")))
+		static uint64_t drawSpanAVX2(const SpanSetup &setup, int originX, int minX, int maxX, int y,
+								 int64_t rowE0, int64_t rowE1, int64_t rowE2,
+								 uint32_t *pixelRow, float *depthRow) {
+			const float offsetY = static_cast<float>(y - setup.originY);
+			const __m256 rowW = _mm256_set1_ps(setup.wRecip.rowValue(offsetY));
+			const __m256 rowU = _mm256_set1_ps(setup.texU.rowValue(offsetY));
+			const __m256 rowV = _mm256_set1_ps(setup.texV.rowValue(offsetY));
+			const __m256 rowLight = _mm256_set1_ps(setup.light.rowValue(offsetY));
+			const __m256 laneOffsets = _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7);
+
+			const __m256 zero = _mm256_setzero_ps();
+			const __m256 one = _mm256_set1_ps(1.0f);
+			uint64_t occludedPixels = 0;
+			const __m256i laneBits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+
+			int x = minX;
+			for(; x + 7 <= maxX; x += 8) {
+				int64_t dx = x - originX;
+				int64_t e0 = rowE0 + setup.colStepE0 * dx;
+				int64_t e1 = rowE1 + setup.colStepE1 * dx;
+				int64_t e2 = rowE2 + setup.colStepE2 * dx;
+
+				// Lanes 0-3 and 4-7 of each edge function
+				__m256i e0Low = _mm256_set_epi64x(e0 + setup.colStepE0 * 3, e0 + setup.colStepE0 * 2, e0 + setup.colStepE0, e0);
+				__m256i e1Low = _mm256_set_epi64x(e1 + setup.colStepE1 * 3, e1 + setup.colStepE1 * 2, e1 + setup.colStepE1, e1);
+				__m256i e2Low = _mm256_set_epi64x(e2 + setup.colStepE2 * 3, e2 + setup.colStepE2 * 2, e2 + setup.colStepE2, e2);
+				__m256i e0High = _mm256_add_epi64(e0Low, _mm256_set1_epi64x(setup.colStepE0 * 4));
+				__m256i e1High = _mm256_add_epi64(e1Low, _mm256_set1_epi64x(setup.colStepE1 * 4));
+				__m256i e2High = _mm256_add_epi64(e2Low, _mm256_set1_epi64x(setup.colStepE2 * 4));
+
+				int coveredMask = 0xFF;
+				if constexpr(TestCoverage) {
+					// The sign bit of (e0 | e1 | e2) is set when the pixel is outside
+					__m256i signsLow = _mm256_or_si256(e0Low, _mm256_or_si256(e1Low, e2Low));
+					__m256i signsHigh = _mm256_or_si256(e0High, _mm256_or_si256(e1High, e2High));
+					int outsideMask = _mm256_movemask_pd(_mm256_castsi256_pd(signsLow)) |
+									  (_mm256_movemask_pd(_mm256_castsi256_pd(signsHigh)) << 4);
+					coveredMask &= ~outsideMask;
+					if(coveredMask == 0)
+						continue;
+				}
+
+				__m256i coveredBits = _mm256_and_si256(_mm256_set1_epi32(coveredMask), laneBits);
+				__m256 covered = _mm256_castsi256_ps(_mm256_cmpeq_epi32(coveredBits, laneBits));
+
+				__m256 offsetX = _mm256_add_ps(_mm256_set1_ps(static_cast<float>(x - setup.originX)), laneOffsets);
+				__m256 wInterpolated = _mm256_add_ps(rowW, _mm256_mul_ps(_mm256_set1_ps(setup.wRecip.stepX), offsetX));
+
+				// Early depth test, only the lanes that pass it are shaded and textured
+				__m256 depth = _mm256_sub_ps(one, wInterpolated);
+				__m256 pass = covered;
+				int passMask = coveredMask;
+				__m256 oldDepth = zero;
+				if constexpr(Config::depthTest || Config::depthWrite) {
+					oldDepth = _mm256_loadu_ps(depthRow + x);
+				}
+				if constexpr(Config::depthTest) {
+					pass = _mm256_and_ps(pass, _mm256_cmp_ps(depth, oldDepth, _CMP_LT_OQ));
+					passMask = _mm256_movemask_ps(pass);
+					occludedPixels += __builtin_popcount(coveredMask & ~passMask);
+					if(passMask == 0)
+						continue;
+				}
+
+				__m256i newPixels = _mm256_set1_epi32(setup.flatColor);
+				if constexpr(!Config::flatColor) {
+					alignas(32) float alphas[8] = {}, betas[8] = {}, gammas[8] = {};
+					alignas(32) float us[8] = {}, vs[8] = {}, lights[8] = {};
+					alignas(32) uint32_t colors[8] = {};
+
+					if constexpr(Config::drawMode == RenderPipeline::DrawMode::GRADIENT) {
+						__m256 areaRecip = _mm256_set1_ps(setup.areaRecip);
+						_mm256_store_ps(alphas, _mm256_mul_ps(int64ToFloatAVX2(e0Low, e0High), areaRecip));
+						_mm256_store_ps(betas, _mm256_mul_ps(int64ToFloatAVX2(e1Low, e1High), areaRecip));
+						_mm256_store_ps(gammas, _mm256_mul_ps(int64ToFloatAVX2(e2Low, e2High), areaRecip));
+					}
+
+					if constexpr(Config::needsLight) {
+						__m256 lightIntensity = _mm256_add_ps(rowLight, _mm256_mul_ps(_mm256_set1_ps(setup.light.stepX), offsetX));
+						lightIntensity = _mm256_max_ps(_mm256_min_ps(lightIntensity, one), zero);
+						_mm256_store_ps(lights, lightIntensity);
+					}
+
+					if constexpr(Config::needsTexCoords) {
+						__m256 wInverse = _mm256_div_ps(one, wInterpolated);
+						__m256 uInterpolated = _mm256_add_ps(rowU, _mm256_mul_ps(_mm256_set1_ps(setup.texU.stepX), offsetX));
+						__m256 vInterpolated = _mm256_add_ps(rowV, _mm256_mul_ps(_mm256_set1_ps(setup.texV.stepX), offsetX));
+						_mm256_store_ps(us, _mm256_mul_ps(uInterpolated, wInverse));
+						_mm256_store_ps(vs, _mm256_mul_ps(vInterpolated, wInverse));
+					}
+
+					// Texture fetches and color packing are done per lane
+					for(int lane = 0; lane < 8; lane++) {
+						if(passMask & (1 << lane)) {
+							colors[lane] = shadePixel<Config>(setup, alphas[lane], betas[lane], gammas[lane],
+															  us[lane], vs[lane], lights[lane]);
+						}
+					}
+
+					newPixels = _mm256_load_si256(reinterpret_cast<const __m256i *>(colors));
+				}
+
+				// Masked stores of the covered pixels that pass the depth test
+				if constexpr(Config::depthWrite) {
+					_mm256_storeu_ps(depthRow + x, _mm256_blendv_ps(oldDepth, depth, pass));
+				}
+
+				__m256i passPixels = _mm256_castps_si256(pass);
+				__m256i oldPixels = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(pixelRow + x));
+				_mm256_storeu_si256(reinterpret_cast<__m256i *>(pixelRow + x), _mm256_blendv_epi8(oldPixels, newPixels, passPixels));
+			}
+
+			occludedPixels += drawSpanScalar<Config, TestCoverage>(setup, originX, x, maxX, y, rowE0, rowE1, rowE2, pixelRow, depthRow);
+			return occludedPixels;
+		}
+#endif
+
+		template<typename Config, bool TestCoverage>
+		static inline uint64_t drawSpan(const SpanSetup &setup, int minX, int maxX, int y,
+										int64_t rowE0, int64_t rowE1, int64_t rowE2,
+										uint32_t *pixelRow, float *depthRow) {
+#ifdef HIRUKI_RASTER_SIMD
+			if constexpr(Config::kernel == RenderPipeline::RasterKernel::AVX2) {
+				return drawSpanAVX2<Config, TestCoverage>(setup, minX, minX, maxX, y, rowE0, rowE1, rowE2, pixelRow, depthRow);
+			} else if constexpr(Config::kernel == RenderPipeline::RasterKernel::SSE) {
+				return drawSpanSSE<Config, TestCoverage>(setup, minX, minX, maxX, y, rowE0, rowE1, rowE2, pixelRow, depthRow);
+			}
+#endif
+			return drawSpanScalar<Config, TestCoverage>(setup, minX, minX, maxX, y, rowE0, rowE1, rowE2, pixelRow, depthRow);
+		}
+
+		enum class BlockCoverage {
+			OUTSIDE,
+			PARTIAL,
+			INSIDE,
+		};
+
+		// Edge functions are linear, so the sign of an edge over a whole block
+		// is known from the values at the centers of its corner pixels.
+		static inline BlockCoverage classifyBlockEdge(int64_t e, int64_t colStep, int64_t rowStep, int width, int height) {
+			int64_t topLeft = e;
+			int64_t topRight = e + colStep * (width - 1);
+			int64_t bottomLeft = e + rowStep * (height - 1);
+			int64_t bottomRight = topRight + rowStep * (height - 1);
+
+			if((topLeft & topRight & bottomLeft & bottomRight) < 0)
+				return BlockCoverage::OUTSIDE;
+			if((topLeft | topRight | bottomLeft | bottomRight) >= 0)
+				return BlockCoverage::INSIDE;
+			return BlockCoverage::PARTIAL;
+		}
+
+		// Counters of a single triangle draw, added to the frame Stats
+		struct RasterCounters {
+			uint64_t untestedPixels = 0;
+			uint64_t occludedPixels = 0;
+			uint64_t hiZRejectedBlocks = 0;
+		};
+
+		// Buffers a triangle is rasterized into. hiZBuffer is null when the
+		// Hi-Z buffer is disabled.
+		struct RasterTarget {
+			uint32_t *pixelBuffer;
+			float *depthBuffer;
+			int width, height;
+
+			float *hiZBuffer;
+			int hiZWidth;
+		};
+
+		// Farthest depth of the block at (blockX, blockY), over the whole block
+		// and not only the part of it covered by the current triangle.
+		static void updateHiZBlock(const RasterTarget &target, int blockX, int blockY) {
+			const int blockSize = RenderPipeline::BLOCK_SIZE;
+			const int maxX = std::min(blockX + blockSize, target.width);
+			const int maxY = std::min(blockY + blockSize, target.height);
+
+			float farthestDepth = target.depthBuffer[blockY * target.width + blockX];
+			for(int y = blockY; y < maxY; y++) {
+				const float *depthRow = target.depthBuffer + y * target.width;
+				for(int x = blockX; x < maxX; x++) {
+					farthestDepth = std::max(farthestDepth, depthRow[x]);
+				}
+			}
+
+			target.hiZBuffer[(blockY / blockSize) * target.hiZWidth + blockX / blockSize] = farthestDepth;
+		}
+
+		// Walks the [minX, maxX] x [minY, maxY] pixel rectangle in BLOCK_SIZE
+		// blocks (aligned to the screen) and classifies each of them: blocks
+		// outside any edge or behind the Hi-Z buffer are skipped, blocks inside
+		// all of them are filled without coverage tests, and only the rest are
+		// tested per pixel.
+		template<typename Config>
+		static RasterCounters drawBlocks(const SpanSetup &setup, int minX, int minY, int maxX, int maxY,
+										 const RasterTarget &target) {
+			const int blockSize = RenderPipeline::BLOCK_SIZE;
+			RasterCounters counters;
+
+			for(int blockY = minY / blockSize * blockSize; blockY <= maxY; blockY += blockSize) {
+				const int y0 = std::max(blockY, minY);
+				const int y1 = std::min(blockY + blockSize - 1, maxY);
+
+				for(int blockX = minX / blockSize * blockSize; blockX <= maxX; blockX += blockSize) {
+					const int x0 = std::max(blockX, minX);
+					const int x1 = std::min(blockX + blockSize - 1, maxX);
+
+					const int width = x1 - x0 + 1;
+					const int height = y1 - y0 + 1;
+
+					const int64_t dx = x0 - setup.originX;
+					const int64_t dy = y0 - setup.originY;
+					int64_t rowE0 = setup.originE0 + setup.colStepE0 * dx + setup.rowStepE0 * dy;
+					int64_t rowE1 = setup.originE1 + setup.colStepE1 * dx + setup.rowStepE1 * dy;
+					int64_t rowE2 = setup.originE2 + setup.colStepE2 * dx + setup.rowStepE2 * dy;
+
+					BlockCoverage coverage0 = classifyBlockEdge(rowE0, setup.colStepE0, setup.rowStepE0, width, height);
+					BlockCoverage coverage1 = classifyBlockEdge(rowE1, setup.colStepE1, setup.rowStepE1, width, height);
+					BlockCoverage coverage2 = classifyBlockEdge(rowE2, setup.colStepE2, setup.rowStepE2, width, height);
+
+					if(coverage0 == BlockCoverage::OUTSIDE || coverage1 == BlockCoverage::OUTSIDE || coverage2 == BlockCoverage::OUTSIDE) {
+						counters.untestedPixels += width * height;
+						continue;
+					}
+
+					// 1/w is linear, so its largest value over the block is at one of the corners
+					if constexpr(Config::depthTest) {
+						if(target.hiZBuffer) {
+							const float offsetX0 = static_cast<float>(x0 - setup.originX);
+							const float offsetX1 = static_cast<float>(x1 - setup.originX);
+							const float offsetY0 = static_cast<float>(y0 - setup.originY);
+							const float offsetY1 = static_cast<float>(y1 - setup.originY);
+							const float cornerWRecip = setup.wRecip.origin +
+													   std::max(setup.wRecip.stepX * offsetX0, setup.wRecip.stepX * offsetX1) +
+													   std::max(setup.wRecip.stepY * offsetY0, setup.wRecip.stepY * offsetY1) +
+													   setup.wRecipError;
+							const float nearestDepth = 1 - std::min(cornerWRecip, setup.nearestWRecip);
+
+							if(nearestDepth >= target.hiZBuffer[(blockY / blockSize) * target.hiZWidth + blockX / blockSize]) {
+								counters.untestedPixels += width * height;
+								counters.hiZRejectedBlocks++;
+								continue;
+							}
+						}
+					}
+
+					const bool inside = coverage0 == BlockCoverage::INSIDE &&
+										coverage1 == BlockCoverage::INSIDE &&
+										coverage2 == BlockCoverage::INSIDE;
+					if(inside) {
+						counters.untestedPixels += width * height;
+					}
+
+					for(int y = y0; y <= y1; y++) {
+						uint32_t *pixelRow = target.pixelBuffer + y * target.width;
+						float *depthRow = target.depthBuffer + y * target.width;
+
+						if(inside) {
+							counters.occludedPixels += drawSpan<Config, false>(setup, x0, x1, y, rowE0, rowE1, rowE2, pixelRow, depthRow);
+						} else {
+							counters.occludedPixels += drawSpan<Config, true>(setup, x0, x1, y, rowE0, rowE1, rowE2, pixelRow, depthRow);
+						}
+
+						rowE0 += setup.rowStepE0;
+						rowE1 += setup.rowStepE1;
+						rowE2 += setup.rowStepE2;
+					}
+
+					if constexpr(Config::depthWrite) {
+						if(target.hiZBuffer) {
+							updateHiZBlock(target, blockX, blockY);
+						}
+					}
+				}
+			}
+
+			return counters;
+		}
+
+		// Picks, once per draw, the drawBlocks instantiation for the current
+		// raster kernel, draw mode, shading mode and depth flags.
+		using BlockKernel = RasterCounters (*)(const SpanSetup &setup, int minX, int minY, int maxX, int maxY,
+											   const RasterTarget &target);
+
+		template<RenderPipeline::RasterKernel Kernel, RenderPipeline::DrawMode Mode, RenderPipeline::ShadingMode Shading>
+		static BlockKernel selectDepthKernel(bool depthTest, bool depthWrite) {
+			if(depthTest && depthWrite)
+				return &drawBlocks<RasterConfig<Kernel, Mode, Shading, true, true>>;
+			if(depthTest)
+				return &drawBlocks<RasterConfig<Kernel, Mode, Shading, true, false>>;
+			if(depthWrite)
+				return &drawBlocks<RasterConfig<Kernel, Mode, Shading, false, true>>;
+			return &drawBlocks<RasterConfig<Kernel, Mode, Shading, false, false>>;
+		}
+
+		template<RenderPipeline::RasterKernel Kernel, RenderPipeline::DrawMode Mode>
+		static BlockKernel selectShadingKernel(RenderPipeline::ShadingMode shadingMode, bool depthTest, bool depthWrite) {
+			switch(shadingMode) {
+				case RenderPipeline::ShadingMode::FLAT:
+					return selectDepthKernel<Kernel, Mode, RenderPipeline::ShadingMode::FLAT>(depthTest, depthWrite);
+				case RenderPipeline::ShadingMode::GORAUD:
+					return selectDepthKernel<Kernel, Mode, RenderPipeline::ShadingMode::GORAUD>(depthTest, depthWrite);
+				default:
+					return selectDepthKernel<Kernel, Mode, RenderPipeline::ShadingMode::NONE>(depthTest, depthWrite);
+			}
+		}
+
+		template<RenderPipeline::RasterKernel Kernel>
+		static BlockKernel selectDrawModeKernel(RenderPipeline::DrawMode drawMode, RenderPipeline::ShadingMode shadingMode,
+												bool depthTest, bool depthWrite) {
+			switch(drawMode) {
+				case RenderPipeline::DrawMode::SOLID:
+					return selectShadingKernel<Kernel, RenderPipeline::DrawMode::SOLID>(shadingMode, depthTest, depthWrite);
+				case RenderPipeline::DrawMode::GRADIENT:
+					return selectShadingKernel<Kernel, RenderPipeline::DrawMode::GRADIENT>(shadingMode, depthTest, depthWrite);
+				default:
+					return selectShadingKernel<Kernel, RenderPipeline::DrawMode::TEXTURED>(shadingMode, depthTest, depthWrite);
+			}
+		}
+
+		// Shades the visible pixels of a row of the visibility buffer, each with the
+		// setup of the triangle whose ID it holds.
+		template<typename Config>
+		static void resolveVisibilityRow(const SpanSetup *setups, const uint32_t *visibilityRow,
+										 uint32_t *pixelRow, int y, int width) {
+			for(int x = 0; x < width; x++) {
+				if(visibilityRow[x] == 0)
+					continue;
+
+				const SpanSetup &setup = setups[visibilityRow[x] - 1];
+
+				const int64_t dx = x - setup.originX;
+				const int64_t dy = y - setup.originY;
+				const int64_t e0 = setup.originE0 + setup.colStepE0 * dx + setup.rowStepE0 * dy;
+				const int64_t e1 = setup.originE1 + setup.colStepE1 * dx + setup.rowStepE1 * dy;
+				const int64_t e2 = setup.originE2 + setup.colStepE2 * dx + setup.rowStepE2 * dy;
+
+				const float offsetX = static_cast<float>(dx);
+				const float offsetY = static_cast<float>(dy);
+				const float wInterpolated = setup.wRecip.rowValue(offsetY) + setup.wRecip.stepX * offsetX;
+
+				pixelRow[x] = shadePlanePixel<Config>(setup, offsetX, wInterpolated,
+													  setup.texU.rowValue(offsetY), setup.texV.rowValue(offsetY),
+													  setup.light.rowValue(offsetY), e0, e1, e2);
+			}
+		}
+
+		using ResolveKernel = void (*)(const SpanSetup *setups, const uint32_t *visibilityRow,
+									   uint32_t *pixelRow, int y, int width);
+
+		template<RenderPipeline::DrawMode Mode>
+		static ResolveKernel selectResolveShadingKernel(RenderPipeline::ShadingMode shadingMode) {
+			using Kernel = RenderPipeline::RasterKernel;
+			switch(shadingMode) {
+				case RenderPipeline::ShadingMode::FLAT:
+					return &resolveVisibilityRow<RasterConfig<Kernel::SCALAR, Mode, RenderPipeline::ShadingMode::FLAT, true, true>>;
+				case RenderPipeline::ShadingMode::GORAUD:
+					return &resolveVisibilityRow<RasterConfig<Kernel::SCALAR, Mode, RenderPipeline::ShadingMode::GORAUD, true, true>>;
+				default:
+					return &resolveVisibilityRow<RasterConfig<Kernel::SCALAR, Mode, RenderPipeline::ShadingMode::NONE, true, true>>;
+			}
+		}
+
+		static ResolveKernel selectResolveKernel(RenderPipeline::DrawMode drawMode, RenderPipeline::ShadingMode shadingMode) {
+			switch(drawMode) {
+				case RenderPipeline::DrawMode::SOLID:
+					return selectResolveShadingKernel<RenderPipeline::DrawMode::SOLID>(shadingMode);
+				case RenderPipeline::DrawMode::GRADIENT:
+					return selectResolveShadingKernel<RenderPipeline::DrawMode::GRADIENT>(shadingMode);
+				default:
+					return selectResolveShadingKernel<RenderPipeline::DrawMode::TEXTURED>(shadingMode);
+			}
+		}
+
+		static BlockKernel selectBlockKernel(RenderPipeline::RasterKernel kernel, RenderPipeline::DrawMode drawMode,
+											 RenderPipeline::ShadingMode shadingMode, bool depthTest, bool depthWrite) {
+			switch(kernel) {
+#ifdef HIRUKI_RASTER_SIMD
+				case RenderPipeline::RasterKernel::AVX2:
+					return selectDrawModeKernel<RenderPipeline::RasterKernel::AVX2>(drawMode, shadingMode, depthTest, depthWrite);
+				case RenderPipeline::RasterKernel::SSE:
+					return selectDrawModeKernel<RenderPipeline::RasterKernel::SSE>(drawMode, shadingMode, depthTest, depthWrite);
+#endif
+				default:
+					return selectDrawModeKernel<RenderPipeline::RasterKernel::SCALAR>(drawMode, shadingMode, depthTest, depthWrite);
+			}
+		}
+
+		bool RenderPipeline::isRasterKernelSupported(RasterKernel kernel) {
+			switch(kernel) {
+				case RasterKernel::SCALAR:
+					return true;
+#ifdef HIRUKI_RASTER_SIMD
+				case RasterKernel::SSE:
+					return true;
+				case RasterKernel::AVX2:
+					__builtin_cpu_init();
+					return __builtin_cpu_supports("avx2");
+#endif
+				default:
+					return false;
+			}
+		}
+
+		void RenderPipeline::setRasterKernel(RasterKernel kernel) {
+			// Fall back to the widest kernel the CPU is able to run
+			while(!isRasterKernelSupported(kernel)) {
+				kernel = static_cast<RasterKernel>(static_cast<int>(kernel) - 1);
+			}
+			m_RasterKernel = kernel;
+		}
+
 		//       v0
 		//      /  ▲
 		//     /    \
@@ -229,230 +1492,451 @@ namespace Hiruki {
 		//
 		// Draw the triangle in counter-clockwise order
 		void RenderPipeline::drawTriangle(const Triangle &triangle) {
-			const Math::Vector4 &v0 = triangle.points[0];
-			const Math::Vector4 &v1 = triangle.points[1];
-			const Math::Vector4 &v2 = triangle.points[2];
+			this->drawTriangle(triangle, 0, 0, m_PixelBufferWidth - 1, m_PixelBufferHeight - 1);
+		}
 
-			const TexCoord &t0 = triangle.texCoords[0];
-			const TexCoord &t1 = triangle.texCoords[1];
-			const TexCoord &t2 = triangle.texCoords[2];
+		void RenderPipeline::drawTriangle(const Triangle &triangle, int clipMinX, int clipMinY, int clipMaxX, int clipMaxY) {
+			rasterizeTriangle(triangle, 0, clipMinX, clipMinY, clipMaxX, clipMaxY);
+		}
 
-			float minX = static_cast<int>(std::min(v0.x, std::min(v1.x, v2.x)));
-			float minY = static_cast<int>(std::min(v0.y, std::min(v1.y, v2.y)));
-			float maxX = static_cast<int>(std::max(v0.x, std::max(v1.x, v2.x)));
-			float maxY = static_cast<int>(std::max(v0.y, std::max(v1.y, v2.y)));
+		// Triangle snapped and set up for one draw, with the kernel picked for it. Shared
+		// by every block row of a parallel draw.
+		struct PreparedTriangle {
+			SpanSetup setup;
+			BlockKernel blockKernel;
+			RasterTarget target;
+
+			// Bounding box, clipped
+			int minX, minY;
+			int maxX, maxY;
+		};
+
+		void RenderPipeline::rasterizeTriangle(const Triangle &triangle, uint32_t visibilityId,
+											   int clipMinX, int clipMinY, int clipMaxX, int clipMaxY) {
+			PreparedTriangle prepared;
+			if(prepareTriangle(triangle, visibilityId, clipMinX, clipMinY, clipMaxX, clipMaxY, prepared)) {
+				rasterizePreparedTriangle(prepared, prepared.minY, prepared.maxY);
+			}
+		}
 
-			Math::Vector2 point(minX, minY);
+		bool RenderPipeline::prepareTriangle(const Triangle &triangle, uint32_t visibilityId,
+											 int clipMinX, int clipMinY, int clipMaxX, int clipMaxY, PreparedTriangle &prepared) {
+			const FixedTriangle fixed = snapTriangle(triangle);
 
-			//  Row edge beginning weights
-			float rowW0 = Math::Vector2::edgeCross(v1, v2, point);
-			float rowW1 = Math::Vector2::edgeCross(v2, v0, point);
-			float rowW2 = Math::Vector2::edgeCross(v0, v1, point);
+			int minX = std::max(fixed.minX, clipMinX);
+			int minY = std::max(fixed.minY, clipMinY);
+			int maxX = std::min(fixed.maxX, clipMaxX);
+			int maxY = std::min(fixed.maxY, clipMaxY);
 
-			// Column and row steps
-			const float colStepW0 = v2.y - v1.y;
-			const float colStepW1 = v0.y - v2.y;
-			const float colStepW2 = v1.y - v0.y;
+			int64_t area = edgeFunction(fixed.x0, fixed.y0, fixed.x1, fixed.y1, fixed.x2, fixed.y2);
 
-			const float rowStepW0 = v1.x - v2.x;
-			const float rowStepW1 = v2.x - v0.x;
-			const float rowStepW2 = v0.x - v1.x;
+			if(area <= 0 || minX > maxX || minY > maxY)
+				return false;
 
-			float area = Math::Vector2::edgeCross(v0, v1, v2);
+			// The visibility pass only writes the (flat) triangle ID, shading is deferred
+			const DrawMode drawMode = visibilityId ? DrawMode::SOLID : m_DrawMode;
+			const ShadingMode shadingMode = visibilityId ? ShadingMode::NONE : m_ShadingMode;
 
-			if(area <= 0)
-				return;
+			if(drawMode == DrawMode::TEXTURED && !triangle.texture) {
+				throw std::invalid_argument("The triangle to draw has no texture attached to it.");
+			}
 
-			// Iterate over each pixel in the bounding box of the triangle
-			for(point.y = minY; point.y <= maxY; point.y++) {
-				float w0 = rowW0;
-				float w1 = rowW1;
-				float w2 = rowW2;
-
-				for(point.x = minX; point.x <= maxX; point.x++) {
-					if(w0 >= 0 && w1 >= 0 && w2 >= 0) {
-						float alpha = w0 / area;
-						float beta = w1 / area;
-						float gamma = w2 / area;
-
-						float wRecip0 = 1 / v0.w;
-						float wRecip1 = 1 / v1.w;
-						float wRecip2 = 1 / v2.w;
-
-						float wInterpolated = wRecip0 * alpha + wRecip1 * beta + wRecip2 * gamma;
-
-						float lightIntensity = triangle.vertexLights[0] * alpha +
-											triangle.vertexLights[1] * beta +
-											triangle.vertexLights[2] * gamma;
-
-						lightIntensity = std::max(0.0f, std::min(1.0f, lightIntensity));
-
-						uint32_t finalColor = 0;
-						switch(m_DrawMode) {
-							case DrawMode::SOLID:
-								finalColor = triangle.color;
-								break;
-							case DrawMode::GRADIENT:
-								finalColor = 
-									colorPercent(0xFF0000FF, alpha) +
-									colorPercent(0x00FF00FF, beta) +
-									colorPercent(0x0000FF00, gamma);
-								break;
-							case DrawMode::TEXTURED:
-								if(!triangle.texture) {
-									throw std::invalid_argument("The triangle to draw has no texture attached to it.");
-								}
-
-								float texU0 = t0.u * wRecip0;
-								float texU1 = t1.u * wRecip1;
-								float texU2 = t2.u * wRecip2;
-
-								float texV0 = t0.v * wRecip0;
-								float texV1 = t1.v * wRecip1;
-								float texV2 = t2.v * wRecip2;
-
-								float uInterpolated = texU0 * alpha + texU1 * beta + texU2 * gamma;
-								float vInterpolated = texV0 * alpha + texV1 * beta + texV2 * gamma;
-
-								uInterpolated /= wInterpolated;
-								vInterpolated /= wInterpolated;
-
-								finalColor = triangle.texture->get().pickColor(uInterpolated, vInterpolated);
-								break;
-						}
+			// The setup is relative to the unclipped bounding box, so that the
+			// attributes of a pixel do not depend on the tile drawing it
+			prepared.setup = makeSpanSetup(triangle, drawMode, shadingMode, fixed, area, fixed.minX, fixed.minY);
+			if(visibilityId) {
+				prepared.setup.flatColor = visibilityId;
+			}
 
-						int index = point.y * m_PixelBufferWidth + point.x;
-						wInterpolated = 1 - wInterpolated;
-						if (index >= 0 && index < m_PixelBufferWidth * m_PixelBufferHeight) {
-							if (wInterpolated < m_DepthBuffer[index]) {
-								drawPixel(point.x, point.y, colorPercent(finalColor, lightIntensity));
-								m_DepthBuffer[index] = wInterpolated;
-							}
+			const bool useHiZ = m_HiZEnabled && m_DepthTestEnabled;
+			if(useHiZ && isBehindHiZ(1 - prepared.setup.nearestWRecip, minX, minY, maxX, maxY)) {
+				uint64_t boundingBoxPixels = static_cast<uint64_t>(maxX - minX + 1) * (maxY - minY + 1);
+
+				// Tiles of the binned rasterizer update the counters concurrently
+				#pragma omp atomic
+				m_Stats.hiZRejectedTriangles++;
+				#pragma omp atomic
+				m_Stats.boundingBoxPixels += boundingBoxPixels;
+				#pragma omp atomic
+				m_Stats.untestedPixels += boundingBoxPixels;
+				return false;
+			}
+
+			prepared.blockKernel = selectBlockKernel(m_RasterKernel, drawMode, shadingMode,
+													 m_DepthTestEnabled, m_DepthWriteEnabled);
+			prepared.target = {
+				visibilityId ? m_VisibilityBuffer.data() : m_PixelBuffer.data(),
+				m_DepthBuffer.data(), m_PixelBufferWidth, m_PixelBufferHeight,
+				useHiZ ? m_HiZBuffer.data() : nullptr, m_HiZWidth
+			};
+			prepared.minX = minX;
+			prepared.minY = minY;
+			prepared.maxX = maxX;
+			prepared.maxY = maxY;
+			return true;
+		}
+
+		void RenderPipeline::rasterizePreparedTriangle(const PreparedTriangle &prepared, int minY, int maxY) {
+			uint64_t boundingBoxPixels = static_cast<uint64_t>(prepared.maxX - prepared.minX + 1) * (maxY - minY + 1);
+			RasterCounters counters = prepared.blockKernel(prepared.setup, prepared.minX, minY, prepared.maxX, maxY, prepared.target);
+
+			#pragma omp atomic
+			m_Stats.boundingBoxPixels += boundingBoxPixels;
+			#pragma omp atomic
+			m_Stats.untestedPixels += counters.untestedPixels;
+			#pragma omp atomic
+			m_Stats.occludedPixels += counters.occludedPixels;
+			#pragma omp atomic
+			m_Stats.hiZRejectedBlocks += counters.hiZRejectedBlocks;
+		}
+
+		bool RenderPipeline::isBehindHiZ(float nearestDepth, int minX, int minY, int maxX, int maxY) const {
+			for(int blockY = minY / BLOCK_SIZE; blockY <= maxY / BLOCK_SIZE; blockY++) {
+				for(int blockX = minX / BLOCK_SIZE; blockX <= maxX / BLOCK_SIZE; blockX++) {
+					if(nearestDepth < m_HiZBuffer[blockY * m_HiZWidth + blockX])
+						return false;
+				}
+			}
+			return true;
+		}
+
+		// Clip space -> Occlusion buffer space
+		static inline Math::Vector4 toOcclusionBuffer(const Math::Vector4 &point) {
+			Math::Vector4 projectedPoint = point.perspectiveDivide();
+			projectedPoint.x = (projectedPoint.x + 1) * (RenderPipeline::OCCLUSION_BUFFER_WIDTH / 2.0);
+			projectedPoint.y = (1 - projectedPoint.y) * (RenderPipeline::OCCLUSION_BUFFER_HEIGHT / 2.0);
+			return projectedPoint;
+		}
+
+		// Whether two faces share an edge, in opposite directions as the halves of a quad do,
+		// in which case quadIndices gets the four corners of the quad, in the same winding
+		static bool findQuad(const uint32_t *face0, const uint32_t *face1, std::array<uint32_t, 4> &quadIndices) {
+			for(int i = 0; i < 3; i++) {
+				const uint32_t from = face0[(i + 1) % 3];
+				const uint32_t to = face0[(i + 2) % 3];
+				for(int j = 0; j < 3; j++) {
+					if(face1[(j + 1) % 3] == to && face1[(j + 2) % 3] == from) {
+						quadIndices = {face0[i], from, face1[j], to};
+						return true;
+					}
+				}
+			}
+			return false;
+		}
+
+		void RenderPipeline::rasterizeOccluder(const Mesh &mesh, const Math::Matrix4 &modelViewMatrix) {
+			const Math::Matrix4 modelViewProjectionMatrix = m_ProjectionMatrix.mul(modelViewMatrix);
+
+			modelViewProjectionMatrix.transformPoints(mesh.vertexStream, m_OccluderVertices);
+			const size_t arenaMarker = m_FrameArena.getMarker();
+			uint8_t *outcodes = m_FrameArena.allocate<uint8_t>(m_OccluderVertices.size());
+			for(size_t i = 0; i < m_OccluderVertices.size(); i++) {
+				outcodes[i] = Clipping::computeOutcode(m_OccluderVertices[i]);
+			}
+
+			// One triangle at a time, for the faces that cannot be drawn as (part of) a polygon
+			auto drawTriangles = [&](const uint32_t *faceIndices, uint8_t clipOutcode) {
+				const Triangle triangle({m_OccluderVertices[faceIndices[0]], m_OccluderVertices[faceIndices[1]], m_OccluderVertices[faceIndices[2]]});
+				m_Clipper.clipTriangleHomogeneous(triangle, clipOutcode, m_ClippedTriangles, false);
+
+				// Clip space -> Occlusion buffer space
+				for(Triangle &clippedTriangle : m_ClippedTriangles) {
+					for(int i = 0; i < 3; i++) {
+						clippedTriangle.points[i] = toOcclusionBuffer(clippedTriangle.points[i]);
+					}
+
+					// Back faces are behind the front faces of a closed occluder anyway
+					if(clippedTriangle.calculateArea2D() > 0) {
+						drawOccluderTriangle(clippedTriangle);
+					}
+				}
+			};
+
+			const size_t faceCount = mesh.indices.size() / 3;
+			for(size_t face = 0; face < faceCount; face++) {
+				const uint32_t *faceIndices = mesh.indices.data() + face * 3;
+
+				// Pixels along the edge shared by the two halves of a quad are entirely inside
+				// neither half, so such faces are drawn together, as a single polygon
+				std::array<uint32_t, 4> polygonIndices = {faceIndices[0], faceIndices[1], faceIndices[2]};
+				size_t pointCount = 3;
+				if(face + 1 < faceCount && findQuad(faceIndices, faceIndices + 3, polygonIndices)) {
+					pointCount = 4;
+				}
+
+				uint8_t outsideOutcode = 0xFF;
+				uint8_t clipOutcode = 0;
+				for(size_t i = 0; i < pointCount; i++) {
+					outsideOutcode &= outcodes[polygonIndices[i]];
+					clipOutcode |= outcodes[polygonIndices[i]];
+				}
+
+				if(!outsideOutcode) {
+					std::array<Math::Vector4, Clipping::MAX_QUAD_POLYGON_VERTICES> polygon;
+					for(size_t i = 0; i < pointCount; i++) {
+						polygon[i] = m_OccluderVertices[polygonIndices[i]];
+					}
+
+					const size_t clippedCount = Clipping::clipPolygonHomogeneous(polygon, pointCount, clipOutcode);
+					for(size_t i = 0; i < clippedCount; i++) {
+						polygon[i] = toOcclusionBuffer(polygon[i]);
+					}
+
+					// Folded quads, and polygons made slightly concave by the snapping
+					if(clippedCount >= 3 && !drawOccluderPolygon(polygon.data(), clippedCount)) {
+						drawTriangles(faceIndices, clipOutcode);
+						if(pointCount == 4) {
+							drawTriangles(faceIndices + 3, clipOutcode);
 						}
 					}
-					
-					w0 += colStepW0;
-					w1 += colStepW1;
-					w2 += colStepW2;
 				}
 
-				rowW0 += rowStepW0;
-				rowW1 += rowStepW1;
-				rowW2 += rowStepW2;
+				if(pointCount == 4) {
+					face++;
+				}
 			}
+			m_FrameArena.rewind(arenaMarker);
 		}
 
-		void RenderPipeline::drawTriangleParallel(const Triangle &triangle) {
-			const Math::Vector4 &v0 = triangle.points[0];
-			const Math::Vector4 &v1 = triangle.points[1];
-			const Math::Vector4 &v2 = triangle.points[2];
+		void RenderPipeline::drawOccluderTriangle(const Triangle &triangle) {
+			const FixedTriangle fixed = snapTriangle(triangle);
 
-			const TexCoord &t0 = triangle.texCoords[0];
-			const TexCoord &t1 = triangle.texCoords[1];
-			const TexCoord &t2 = triangle.texCoords[2];
+			const int minX = std::max(fixed.minX, 0);
+			const int minY = std::max(fixed.minY, 0);
+			const int maxX = std::min(fixed.maxX, OCCLUSION_BUFFER_WIDTH - 1);
+			const int maxY = std::min(fixed.maxY, OCCLUSION_BUFFER_HEIGHT - 1);
 
-			float minX = static_cast<int>(std::min(v0.x, std::min(v1.x, v2.x)));
-			float minY = static_cast<int>(std::min(v0.y, std::min(v1.y, v2.y)));
-			float maxX = static_cast<int>(std::max(v0.x, std::max(v1.x, v2.x)));
-			float maxY = static_cast<int>(std::max(v0.y, std::max(v1.y, v2.y)));
+			const int64_t area = edgeFunction(fixed.x0, fixed.y0, fixed.x1, fixed.y1, fixed.x2, fixed.y2);
+			if(area <= 0 || minX > maxX || minY > maxY)
+				return;
 
-			Math::Vector2 point(minX, minY);
+			// Same edge functions and 1/w plane as the color passes, only the depth is written
+			const SpanSetup setup = makeSpanSetup(triangle, DrawMode::SOLID, ShadingMode::NONE, fixed, area, minX, minY);
+
+			// The buffer must never be nearer than the occluder anywhere in a pixel. So a pixel is
+			// only written when its four corners, half a step from its center along both axes, are
+			// inside every edge, with the farthest depth of those corners.
+			const int64_t inset0 = (std::abs(setup.colStepE0) + std::abs(setup.rowStepE0)) / 2;
+			const int64_t inset1 = (std::abs(setup.colStepE1) + std::abs(setup.rowStepE1)) / 2;
+			const int64_t inset2 = (std::abs(setup.colStepE2) + std::abs(setup.rowStepE2)) / 2;
+			const float wRecipInset = (std::fabs(setup.wRecip.stepX) + std::fabs(setup.wRecip.stepY)) / 2 + setup.wRecipError;
+
+			int64_t rowE0 = setup.originE0;
+			int64_t rowE1 = setup.originE1;
+			int64_t rowE2 = setup.originE2;
+			for(int y = minY; y <= maxY; y++) {
+				float *depthRow = m_OcclusionBuffer.data() + y * OCCLUSION_BUFFER_WIDTH;
+				const float rowWRecip = setup.wRecip.rowValue(y - minY);
+
+				int64_t e0 = rowE0, e1 = rowE1, e2 = rowE2;
+				for(int x = minX; x <= maxX; x++) {
+					if(e0 >= inset0 && e1 >= inset1 && e2 >= inset2) {
+						const float farthestDepth = 1 - (rowWRecip + setup.wRecip.stepX * (x - minX) - wRecipInset);
+						depthRow[x] = std::min(depthRow[x], farthestDepth);
+					}
 
-			//  Row edge beginning weights
-			const float rowW0 = Math::Vector2::edgeCross(v1, v2, point);
-			const float rowW1 = Math::Vector2::edgeCross(v2, v0, point);
-			const float rowW2 = Math::Vector2::edgeCross(v0, v1, point);
+					e0 += setup.colStepE0;
+					e1 += setup.colStepE1;
+					e2 += setup.colStepE2;
+				}
 
-			// Column and row steps
-			const float colStepW0 = v2.y - v1.y;
-			const float colStepW1 = v0.y - v2.y;
-			const float colStepW2 = v1.y - v0.y;
+				rowE0 += setup.rowStepE0;
+				rowE1 += setup.rowStepE1;
+				rowE2 += setup.rowStepE2;
+			}
+		}
 
-			const float rowStepW0 = v1.x - v2.x;
-			const float rowStepW1 = v2.x - v0.x;
-			const float rowStepW2 = v0.x - v1.x;
+		bool RenderPipeline::drawOccluderPolygon(const Math::Vector4 *points, size_t pointCount) {
+			std::array<int64_t, Clipping::MAX_QUAD_POLYGON_VERTICES> xs, ys;
+			int64_t minPointX = INT64_MAX, minPointY = INT64_MAX;
+			int64_t maxPointX = INT64_MIN, maxPointY = INT64_MIN;
+			for(size_t i = 0; i < pointCount; i++) {
+				xs[i] = std::llround(points[i].x * SUBPIXEL_SCALE);
+				ys[i] = std::llround(points[i].y * SUBPIXEL_SCALE);
+				minPointX = std::min(minPointX, xs[i]);
+				minPointY = std::min(minPointY, ys[i]);
+				maxPointX = std::max(maxPointX, xs[i]);
+				maxPointY = std::max(maxPointY, ys[i]);
+			}
 
-			float area = Math::Vector2::edgeCross(v0, v1, v2);
+			// Only convex polygons are inside all of their edges, the others are left to the caller
+			int64_t area = 0;
+			for(size_t i = 0; i < pointCount; i++) {
+				const size_t next = (i + 1) % pointCount;
+				const size_t after = (i + 2) % pointCount;
+				if(edgeFunction(xs[i], ys[i], xs[next], ys[next], xs[after], ys[after]) < 0)
+					return false;
+				if(i > 0 && next > 0) {
+					area += edgeFunction(xs[0], ys[0], xs[i], ys[i], xs[next], ys[next]);
+				}
+			}
+
+			// Pixels entirely inside the bounds of the points
+			const int minX = std::max(static_cast<int>((minPointX + SUBPIXEL_SCALE - 1) >> SUBPIXEL_BITS), 0);
+			const int minY = std::max(static_cast<int>((minPointY + SUBPIXEL_SCALE - 1) >> SUBPIXEL_BITS), 0);
+			const int maxX = std::min(static_cast<int>(maxPointX >> SUBPIXEL_BITS) - 1, OCCLUSION_BUFFER_WIDTH - 1);
+			const int maxY = std::min(static_cast<int>(maxPointY >> SUBPIXEL_BITS) - 1, OCCLUSION_BUFFER_HEIGHT - 1);
+			if(area <= 0 || minX > maxX || minY > maxY)
+				return true;
+
+			// Same corner test as drawOccluderTriangle, against the edges of the polygon only
+			std::array<int64_t, Clipping::MAX_QUAD_POLYGON_VERTICES> rowEdges, colSteps, rowSteps, insets;
+			const int64_t pointX = (static_cast<int64_t>(minX) << SUBPIXEL_BITS) + SUBPIXEL_SCALE / 2;
+			const int64_t pointY = (static_cast<int64_t>(minY) << SUBPIXEL_BITS) + SUBPIXEL_SCALE / 2;
+			for(size_t i = 0; i < pointCount; i++) {
+				const size_t next = (i + 1) % pointCount;
+				rowEdges[i] = edgeFunction(xs[i], ys[i], xs[next], ys[next], pointX, pointY);
+				colSteps[i] = (ys[next] - ys[i]) * SUBPIXEL_SCALE;
+				rowSteps[i] = (xs[i] - xs[next]) * SUBPIXEL_SCALE;
+				insets[i] = (std::abs(colSteps[i]) + std::abs(rowSteps[i])) / 2;
+			}
+
+			// The triangles of a quad need not be in the same plane. Each pixel gets the farthest
+			// depth of all their 1/w planes, which is never nearer than the one it is in.
+			class DepthPlane {
+				public:
+					AttributePlane wRecip;
+					float inset;
+			};
+			std::array<DepthPlane, Clipping::MAX_QUAD_POLYGON_VERTICES - 2> planes;
+			size_t planeCount = 0;
+			for(size_t i = 1; i + 1 < pointCount; i++) {
+				FixedTriangle fixed = {xs[0], ys[0], xs[i], ys[i], xs[i + 1], ys[i + 1], minX, minY, maxX, maxY};
+				const int64_t triangleArea = edgeFunction(fixed.x0, fixed.y0, fixed.x1, fixed.y1, fixed.x2, fixed.y2);
+				if(triangleArea <= 0)
+					continue;
+
+				const Triangle triangle({points[0], points[i], points[i + 1]});
+				const SpanSetup setup = makeSpanSetup(triangle, DrawMode::SOLID, ShadingMode::NONE, fixed, triangleArea, minX, minY);
+				planes[planeCount++] = {setup.wRecip, (std::fabs(setup.wRecip.stepX) + std::fabs(setup.wRecip.stepY)) / 2 + setup.wRecipError};
+			}
 
-			if(area <= 0)
+			for(int y = minY; y <= maxY; y++) {
+				float *depthRow = m_OcclusionBuffer.data() + y * OCCLUSION_BUFFER_WIDTH;
+				for(int x = minX; x <= maxX; x++) {
+					bool inside = true;
+					for(size_t i = 0; i < pointCount && inside; i++) {
+						inside = rowEdges[i] + colSteps[i] * (x - minX) >= insets[i];
+					}
+					if(!inside)
+						continue;
+
+					float farthestWRecip = FLT_MAX;
+					for(size_t i = 0; i < planeCount; i++) {
+						const AttributePlane &wRecip = planes[i].wRecip;
+						farthestWRecip = std::min(farthestWRecip, wRecip.rowValue(y - minY) + wRecip.stepX * (x - minX) - planes[i].inset);
+					}
+					depthRow[x] = std::min(depthRow[x], 1 - farthestWRecip);
+				}
+
+				for(size_t i = 0; i < pointCount; i++) {
+					rowEdges[i] += rowSteps[i];
+				}
+			}
+
+			return true;
+		}
+
+		bool RenderPipeline::isMeshOccluded(const Mesh &mesh, const Math::Matrix4 &modelViewMatrix) const {
+			if(mesh.boundingSphereRadius < 0)
+				return false;
+
+			const Math::Matrix4 modelViewProjectionMatrix = m_ProjectionMatrix.mul(modelViewMatrix);
+
+			float minX = FLT_MAX, minY = FLT_MAX;
+			float maxX = -FLT_MAX, maxY = -FLT_MAX;
+			float nearestDepth = 1;
+			for(int corner = 0; corner < 8; corner++) {
+				const Math::Vector3 objectCorner(
+					corner & 1 ? mesh.boundingBoxMax.x : mesh.boundingBoxMin.x,
+					corner & 2 ? mesh.boundingBoxMax.y : mesh.boundingBoxMin.y,
+					corner & 4 ? mesh.boundingBoxMax.z : mesh.boundingBoxMin.z
+				);
+				const Math::Vector4 clipCorner = modelViewProjectionMatrix.mul(objectCorner);
+
+				// Boxes crossing the near plane have no bounded screen rectangle
+				if(clipCorner.z < 0)
+					return false;
+
+				const Math::Vector4 projectedCorner = clipCorner.perspectiveDivide();
+				const float x = (projectedCorner.x + 1) * (OCCLUSION_BUFFER_WIDTH / 2.0);
+				const float y = (1 - projectedCorner.y) * (OCCLUSION_BUFFER_HEIGHT / 2.0);
+				minX = std::min(minX, x);
+				minY = std::min(minY, y);
+				maxX = std::max(maxX, x);
+				maxY = std::max(maxY, y);
+				nearestDepth = std::min(nearestDepth, static_cast<float>(1 - 1 / clipCorner.w));
+			}
+
+			if(maxX < 0 || maxY < 0 || minX >= OCCLUSION_BUFFER_WIDTH || minY >= OCCLUSION_BUFFER_HEIGHT)
+				return false;
+
+			// Every pixel the rectangle touches
+			const int x0 = static_cast<int>(std::max(minX, 0.0f));
+			const int y0 = static_cast<int>(std::max(minY, 0.0f));
+			const int x1 = static_cast<int>(std::min(maxX, OCCLUSION_BUFFER_WIDTH - 1.0f));
+			const int y1 = static_cast<int>(std::min(maxY, OCCLUSION_BUFFER_HEIGHT - 1.0f));
+
+			for(int y = y0; y <= y1; y++) {
+				const float *depthRow = m_OcclusionBuffer.data() + y * OCCLUSION_BUFFER_WIDTH;
+				for(int x = x0; x <= x1; x++) {
+					if(nearestDepth < depthRow[x])
+						return false;
+				}
+			}
+			return true;
+		}
+
+		void RenderPipeline::drawTriangleParallel(const Triangle &triangle) {
+			rasterizeTriangleParallel(triangle, 0);
+		}
+
+		void RenderPipeline::rasterizeTriangleParallel(const Triangle &triangle, uint32_t visibilityId) {
+			// Snapped, set up, tested against the Hi-Z buffer and given a kernel once for the whole screen
+			PreparedTriangle prepared;
+			if(!prepareTriangle(triangle, visibilityId, 0, 0, m_PixelBufferWidth - 1, m_PixelBufferHeight - 1, prepared))
 				return;
 
-			// Iterate over each pixel in the bounding box of the triangle
-			int maxRowIndex = maxY - minY;
+			// Each thread draws whole rows of blocks of the triangle
+			const int firstBlockRow = prepared.minY / BLOCK_SIZE;
+			const int lastBlockRow = prepared.maxY / BLOCK_SIZE;
 			#pragma omp parallel for schedule(dynamic)
-			for(int rowIndex = 0; rowIndex <= maxRowIndex; rowIndex++) {
-				float y = minY + rowIndex;
-
-				float w0 = rowW0 + rowStepW0 * static_cast<float>(rowIndex);
-				float w1 = rowW1 + rowStepW1 * static_cast<float>(rowIndex);
-				float w2 = rowW2 + rowStepW2 * static_cast<float>(rowIndex);
-
-				for(float x = minX; x <= maxX; x++) {
-					if(w0 >= 0 && w1 >= 0 && w2 >= 0) {
-						float alpha = w0 / area;
-						float beta = w1 / area;
-						float gamma = w2 / area;
-
-						float wRecip0 = 1 / v0.w;
-						float wRecip1 = 1 / v1.w;
-						float wRecip2 = 1 / v2.w;
-
-						float wInterpolated = wRecip0 * alpha + wRecip1 * beta + wRecip2 * gamma;
-
-						float lightIntensity = triangle.vertexLights[0] * alpha +
-											triangle.vertexLights[1] * beta +
-											triangle.vertexLights[2] * gamma;
-
-						lightIntensity = std::max(0.0f, std::min(1.0f, lightIntensity));
-
-						uint32_t finalColor = 0;
-						switch(m_DrawMode) {
-							case DrawMode::SOLID:
-								finalColor = triangle.color;
-								break;
-							case DrawMode::GRADIENT:
-								finalColor = 
-									colorPercent(0xFF0000FF, alpha) +
-									colorPercent(0x00FF00FF, beta) +
-									colorPercent(0x0000FF00, gamma);
-								break;
-							case DrawMode::TEXTURED:
-								if(!triangle.texture) {
-									throw std::invalid_argument("The triangle to draw has no texture attached to it.");
-								}
-
-								float texU0 = t0.u * wRecip0;
-								float texU1 = t1.u * wRecip1;
-								float texU2 = t2.u * wRecip2;
-
-								float texV0 = t0.v * wRecip0;
-								float texV1 = t1.v * wRecip1;
-								float texV2 = t2.v * wRecip2;
-
-								float uInterpolated = texU0 * alpha + texU1 * beta + texU2 * gamma;
-								float vInterpolated = texV0 * alpha + texV1 * beta + texV2 * gamma;
-
-								uInterpolated /= wInterpolated;
-								vInterpolated /= wInterpolated;
-
-								finalColor = triangle.texture->get().pickColor(uInterpolated, vInterpolated);
-								break;
-						}
+			for(int blockRow = firstBlockRow; blockRow <= lastBlockRow; blockRow++) {
+				int rowMinY = std::max(blockRow * BLOCK_SIZE, prepared.minY);
+				int rowMaxY = std::min(blockRow * BLOCK_SIZE + BLOCK_SIZE - 1, prepared.maxY);
 
-						int index = y * m_PixelBufferWidth + x;
-						wInterpolated = 1 - wInterpolated;
-						if (index >= 0 && index < m_PixelBufferWidth * m_PixelBufferHeight) {
-							if (wInterpolated < m_DepthBuffer[index]) {
-								drawPixel(x, y, colorPercent(finalColor, lightIntensity));
-								m_DepthBuffer[index] = wInterpolated;
-							}
-						}
-					}
-					
-					w0 += colStepW0;
-					w1 += colStepW1;
-					w2 += colStepW2;
+				this->rasterizePreparedTriangle(prepared, rowMinY, rowMaxY);
+			}
+		}
+
+		void RenderPipeline::resolveVisibilityBuffer() {
+			// Same setups as the forward path, so both produce the same colors
+			SpanSetup *setups = m_FrameArena.allocate<SpanSetup>(m_FrameTriangles.size());
+			for(size_t i = 0; i < m_FrameTriangles.size(); i++) {
+				const Triangle &triangle = m_FrameTriangles[i];
+				const FixedTriangle fixed = snapTriangle(triangle);
+				int64_t area = edgeFunction(fixed.x0, fixed.y0, fixed.x1, fixed.y1, fixed.x2, fixed.y2);
+
+				// Degenerate triangles never get an ID written, so no setup is needed
+				if(area <= 0) {
+					new (&setups[i]) SpanSetup{&triangle};
+					continue;
 				}
+
+				if(m_DrawMode == DrawMode::TEXTURED && !triangle.texture) {
+					throw std::invalid_argument("The triangle to draw has no texture attached to it.");
+				}
+
+				new (&setups[i]) SpanSetup(makeSpanSetup(triangle, m_DrawMode, m_ShadingMode, fixed, area, fixed.minX, fixed.minY));
+			}
+
+			const ResolveKernel resolveRow = selectResolveKernel(m_DrawMode, m_ShadingMode);
+
+			// Every visible pixel is shaded once, independently of the others
+			#pragma omp parallel for schedule(static)
+			for(int y = 0; y < m_PixelBufferHeight; y++) {
+				resolveRow(setups, m_VisibilityBuffer.data() + y * m_PixelBufferWidth,
+						   m_PixelBuffer.data() + y * m_PixelBufferWidth, y, m_PixelBufferWidth);
 			}
 		}
 
@@ -482,10 +1966,13 @@ namespace Hiruki {
 				float w = w0Recip + t * (w1Recip - w0Recip);
 				w = 1 - w - 0.01;
 
-				int index = std::roundf(point.y) * m_PixelBufferWidth + std::roundf(point.x);
-				if (index >= 0 && index < m_PixelBufferWidth * m_PixelBufferHeight) {
+				// Lines of guard band triangles can go past any side of the screen
+				int x = std::roundf(point.x);
+				int y = std::roundf(point.y);
+				if (x >= 0 && y >= 0 && x < m_PixelBufferWidth && y < m_PixelBufferHeight) {
+					int index = y * m_PixelBufferWidth + x;
 					if (w< m_DepthBuffer[index]) {
-						drawPixel(std::roundf(point.x), std::roundf(point.y), color);
+						drawPixel(x, y, color);
 						m_DepthBuffer[index] = w;
 					}
 				}
@@ -1,16 +1,29 @@
 #ifndef HIRUKI_GRAPHICS_RENDER_PIPELINE_H
 #define HIRUKI_GRAPHICS_RENDER_PIPELINE_H
 
+#include "graphics/boundingVolumeHierarchy.hpp"
+#include "graphics/clipping.hpp"
+#include "graphics/frameArena.hpp"
 #include "graphics/mesh.hpp"
 #include "graphics/triangle.hpp"
+#include "math/matrix4.hpp"
 #include "math/vector2.hpp"
 #include "math/vector3.hpp"
+#include "math/vectorStream.hpp"
 #include "scene.hpp"
 #include <SDL2/SDL_render.h>
 #include <vector>
 
+// The vectorized raster kernels use SSE2/AVX2 intrinsics, so they are only
+// built on x86 with compilers that support per-function target attributes.
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__) && defined(__GNUC__)
+#define HIRUKI_RASTER_SIMD
+#endif
+
 namespace Hiruki {
 	namespace Graphics {
+		struct PreparedTriangle;
+
 		class RenderPipeline {
 			public:
 				enum class DrawMode {
@@ -23,6 +36,74 @@ namespace Hiruki {
 					FLAT,
 					GORAUD
 				};
+				// Inner loop used to rasterize each row of a triangle. All of them
+				// produce the same output, the wider ones just do it faster.
+				enum class RasterKernel {
+					SCALAR,
+					SSE, // 4 pixels at once
+					AVX2, // 8 pixels at once
+				};
+				// Space triangles are clipped in. Clip space clipping projects the vertices
+				// first, and tests them against the canonical -w <= x, y <= w, 0 <= z <= w planes.
+				enum class ClippingMode {
+					VIEW_SPACE,
+					CLIP_SPACE,
+				};
+
+				// Size, in pixels, of the square screen tiles used by the binned rasterizer
+				static constexpr int TILE_SIZE = 64;
+				// Vertices are snapped to 1/SUBPIXEL_SCALE of a pixel before rasterizing
+				static constexpr int SUBPIXEL_BITS = 8;
+				static constexpr int SUBPIXEL_SCALE = 1 << SUBPIXEL_BITS;
+				// Size, in pixels, of the blocks triangles are traversed by. Blocks
+				// fully outside or inside a triangle skip the per-pixel coverage tests.
+				static constexpr int BLOCK_SIZE = 8;
+				// Blocks are also the cells of the Hi-Z buffer, so that each of them is
+				// written by a single tile
+				static_assert(TILE_SIZE % BLOCK_SIZE == 0, "Tiles must be made of whole blocks");
+				// Triangles are only clipped against the sides of a frustum this many times
+				// wider and taller than the view, the rasterizer skips the rest of the
+				// off-screen pixels. Keeps screen coordinates small enough for fixed-point.
+				static constexpr float GUARD_BAND_SCALE = 4;
+				// Size of the depth buffer the occluder meshes are rasterized into
+				static constexpr int OCCLUSION_BUFFER_WIDTH = 256;
+				static constexpr int OCCLUSION_BUFFER_HEIGHT = 128;
+
+				// Counters of the last rendered frame
+				class Stats {
+					public:
+						// Pixels inside the (clipped) bounding boxes of the rasterized triangles
+						uint64_t boundingBoxPixels = 0;
+						// Bounding box pixels in blocks that were skipped or filled without coverage tests
+						uint64_t untestedPixels = 0;
+						// Covered pixels that failed the early depth test, so were not shaded nor textured
+						uint64_t occludedPixels = 0;
+						// Triangle draws (one per tile or row of blocks when drawing in
+						// parallel) rejected whole by the Hi-Z buffer
+						uint64_t hiZRejectedTriangles = 0;
+						// Blocks of the remaining triangles rejected by the Hi-Z buffer
+						uint64_t hiZRejectedBlocks = 0;
+						// Triangles with all their points outside one plane of the view, dropped
+						// before back-face culling
+						uint64_t trivialRejectedTriangles = 0;
+						// Front-facing triangles inside every (guard band) plane, which skipped the clipper
+						uint64_t trivialAcceptedTriangles = 0;
+						// Front-facing triangles crossing a plane, which went through the clipper
+						uint64_t clippedTriangles = 0;
+						// Meshes whose bounds are outside the view, skipped before transforming any vertex
+						uint64_t culledMeshes = 0;
+						// Meshes whose bounds are behind the occluders, skipped before transforming any vertex
+						uint64_t occludedMeshes = 0;
+						// Peak bytes used by the transient buffers of the frame
+						uint64_t frameArenaBytes = 0;
+
+						float untestedPixelFraction() const {
+							if(boundingBoxPixels == 0)
+								return 0;
+							return static_cast<float>(untestedPixels) / boundingBoxPixels;
+						}
+				};
+
 				RenderPipeline() {}
 				RenderPipeline(int renderWidth, int renderHeight, SDL_Renderer *renderer);
 
@@ -35,6 +116,10 @@ namespace Hiruki {
 				SDL_Texture * pixelBufferTexture() {
 					return m_PixelBufferTexture;
 				}
+				// Pixels of the last rendered frame, row by row
+				const std::vector<uint32_t> &getPixelBuffer() const {
+					return m_PixelBuffer;
+				}
 
 				RenderPipeline& operator=(RenderPipeline&& other) noexcept {
 					if (this != &other) {
@@ -46,12 +131,46 @@ namespace Hiruki {
 
 						m_PixelBuffer = std::move(other.m_PixelBuffer);
 						m_DepthBuffer = std::move(other.m_DepthBuffer);
+						m_HiZBuffer = std::move(other.m_HiZBuffer);
+						m_HiZWidth = other.m_HiZWidth;
+						m_HiZHeight = other.m_HiZHeight;
+						m_HiZEnabled = other.m_HiZEnabled;
+						m_VisibilityBuffer = std::move(other.m_VisibilityBuffer);
+						m_VisibilityBufferEnabled = other.m_VisibilityBufferEnabled;
+						m_GuardBandEnabled = other.m_GuardBandEnabled;
+						m_FrustumCullingEnabled = other.m_FrustumCullingEnabled;
+						m_BoundingVolumeHierarchyEnabled = other.m_BoundingVolumeHierarchyEnabled;
+						m_BoundingVolumeHierarchy = std::move(other.m_BoundingVolumeHierarchy);
+						m_VisibleMeshes = std::move(other.m_VisibleMeshes);
+						m_OcclusionCullingEnabled = other.m_OcclusionCullingEnabled;
+						m_OcclusionBuffer = std::move(other.m_OcclusionBuffer);
+						m_OccluderVertices = std::move(other.m_OccluderVertices);
+						m_MeshClipVertices = std::move(other.m_MeshClipVertices);
+						m_GeometryThreads = std::move(other.m_GeometryThreads);
+						m_FrameArena = std::move(other.m_FrameArena);
+						m_ClippedTriangles = std::move(other.m_ClippedTriangles);
+						m_ClippingMode = other.m_ClippingMode;
+						m_ProjectionMatrix = other.m_ProjectionMatrix;
+						m_Clipper = other.m_Clipper;
 
 						m_DrawMode = other.m_DrawMode;
 						m_ShadingMode = other.m_ShadingMode;
 
 						m_WireframeEnabled = other.m_WireframeEnabled;
 						m_WireframeColor = other.m_WireframeColor;
+
+						m_DepthTestEnabled = other.m_DepthTestEnabled;
+						m_DepthWriteEnabled = other.m_DepthWriteEnabled;
+
+						m_RasterKernel = other.m_RasterKernel;
+						m_Stats = other.m_Stats;
+
+						m_BinningEnabled = other.m_BinningEnabled;
+						m_TileCountX = other.m_TileCountX;
+						m_TileCountY = other.m_TileCountY;
+						m_TileBinStarts = other.m_TileBinStarts;
+						m_TileBinTriangles = other.m_TileBinTriangles;
+						m_FrameTriangles = std::move(other.m_FrameTriangles);
 					}
 					return *this;
 				}
@@ -63,13 +182,46 @@ namespace Hiruki {
 				void setShadingMode(ShadingMode shadingMode) { m_ShadingMode = shadingMode; }
 				void setWireframeEnabled(bool enabled) { m_WireframeEnabled = enabled; }
 				void setWireframeColor(uint32_t color) { m_WireframeColor = color; }
+				void setDepthTestEnabled(bool enabled) { m_DepthTestEnabled = enabled; }
+				void setDepthWriteEnabled(bool enabled) { m_DepthWriteEnabled = enabled; }
+				void setBinningEnabled(bool enabled) { m_BinningEnabled = enabled; }
+				void setHiZEnabled(bool enabled) { m_HiZEnabled = enabled; }
+				// Rasterizes only depth and triangle IDs, then shades every visible pixel once
+				void setVisibilityBufferEnabled(bool enabled) { m_VisibilityBufferEnabled = enabled; }
+				void setGuardBandEnabled(bool enabled) { m_GuardBandEnabled = enabled; }
+				void setFrustumCullingEnabled(bool enabled) { m_FrustumCullingEnabled = enabled; }
+				// Keeps the submitted meshes in a tree between frames, so that culling them
+				// costs in proportion to the visible meshes. Worth it for scenes of many meshes.
+				void setBoundingVolumeHierarchyEnabled(bool enabled) { m_BoundingVolumeHierarchyEnabled = enabled; }
+				// Tests the meshes against the depth of the meshes marked as occluders,
+				// rasterized beforehand into a small conservative depth buffer
+				void setOcclusionCullingEnabled(bool enabled) { m_OcclusionCullingEnabled = enabled; }
+				void setClippingMode(ClippingMode clippingMode) { m_ClippingMode = clippingMode; }
+				// Falls back to the widest supported kernel if the CPU cannot run the requested one
+				void setRasterKernel(RasterKernel kernel);
 
 				DrawMode getDrawMode() const { return m_DrawMode; };
 				ShadingMode getShadingMode() const { return m_ShadingMode; };
 				bool getWireframeEnabled() const { return m_WireframeEnabled; }
 				uint32_t getWireframeColor() const { return m_WireframeColor; }
+				bool getDepthTestEnabled() const { return m_DepthTestEnabled; }
+				bool getDepthWriteEnabled() const { return m_DepthWriteEnabled; }
+				bool getBinningEnabled() const { return m_BinningEnabled; }
+				bool getHiZEnabled() const { return m_HiZEnabled; }
+				bool getVisibilityBufferEnabled() const { return m_VisibilityBufferEnabled; }
+				bool getGuardBandEnabled() const { return m_GuardBandEnabled; }
+				bool getFrustumCullingEnabled() const { return m_FrustumCullingEnabled; }
+				bool getBoundingVolumeHierarchyEnabled() const { return m_BoundingVolumeHierarchyEnabled; }
+				bool getOcclusionCullingEnabled() const { return m_OcclusionCullingEnabled; }
+				ClippingMode getClippingMode() const { return m_ClippingMode; }
+				RasterKernel getRasterKernel() const { return m_RasterKernel; }
+				const Stats &getStats() const { return m_Stats; }
+
+				static bool isRasterKernelSupported(RasterKernel kernel);
 				
 				void drawTriangle(const Triangle &triangle);
+				// Only draws the pixels inside the [clipMinX, clipMaxX] x [clipMinY, clipMaxY] screen rectangle
+				void drawTriangle(const Triangle &triangle, int clipMinX, int clipMinY, int clipMaxX, int clipMaxY);
 				void drawTriangleParallel(const Triangle &triangle);
 
 				void drawTriangleWireframe(const Triangle &triangle, uint32_t color);
@@ -78,10 +230,132 @@ namespace Hiruki {
 				void drawPixel(int x, int y, uint32_t color);
 
 			private:
+				static constexpr float FOV_Y = 60.0;
+				static constexpr float Z_NEAR = 0.1;
+				static constexpr float Z_FAR = 50.0;
+				// Faces of a mesh are handed to the geometry threads in chunks of this many
+				static constexpr uint32_t FACE_CHUNK_SIZE = 256;
+
+				// Vertex stage outputs of a mesh drawn this frame. The arrays are in the frame arena.
+				class MeshGeometry {
+					public:
+						const Mesh *mesh;
+						Math::Matrix4 modelViewProjectionMatrix;
+						// Set for one geometry of each mesh, which updates its world space caches
+						bool updatesWorldCache;
+						// Caches of the mesh, once updated
+						const std::vector<Math::Vector3> *worldVertices;
+						const std::vector<Math::Vector3> *worldNormals;
+
+						const Math::Vector4Stream *clipVertices;
+						uint8_t *vertexOutcodes;
+						uint8_t *vertexClipOutcodes;
+						// Only when flat shading or clipping in view space
+						Math::Vector4 *viewVertices;
+						// Only when Goraud shading, one per normal
+						float *vertexLights;
+				};
+
+				// Faces of one material of a mesh, turned into screen space triangles by a single
+				// thread, into the range [firstTriangle, firstTriangle + triangleCount) of its list
+				class FaceChunk {
+					public:
+						uint32_t geometry;
+						uint32_t firstFace;
+						uint32_t faceCount;
+						const Texture *texture;
+						int thread;
+						uint32_t firstTriangle;
+						uint32_t triangleCount;
+				};
+
+				// Output and scratch buffers of a geometry thread, kept between frames to reuse their memory
+				class GeometryThread {
+					public:
+						std::vector<Triangle> triangles;
+						std::vector<Triangle> clippedTriangles;
+						Stats stats;
+				};
+
+				// Rebuilds the projection and the clipping planes, which only depend on the size
+				void updateProjection();
+				// Tests the bounding sphere, then the bounding box, of a mesh against the view
+				bool isMeshOutsideView(const Mesh &mesh, const Math::Matrix4 &modelViewMatrix) const;
+				// Depth-only rasterization of an occluder into the occlusion buffer
+				void rasterizeOccluder(const Mesh &mesh, const Math::Matrix4 &modelViewMatrix);
+				void drawOccluderTriangle(const Triangle &triangle);
+				// Same, for a convex polygon (a quad or a clipped face) in occlusion buffer space.
+				// Returns false, without drawing anything, if the polygon is not convex.
+				bool drawOccluderPolygon(const Math::Vector4 *points, size_t pointCount);
+				// Tests the screen rectangle of the bounding box of a mesh against the occlusion buffer
+				bool isMeshOccluded(const Mesh &mesh, const Math::Matrix4 &modelViewMatrix) const;
+				void transformMeshVertices(MeshGeometry &geometry, const Math::Matrix4 &viewMatrix,
+										   const Math::Vector3 &lightDirection, Math::Vector4Stream &clipVertices) const;
+				// Back-face culling, lighting, clipping and projection of the faces of a chunk
+				void processFaceChunk(FaceChunk &chunk, const MeshGeometry &geometry, GeometryThread &thread) const;
+				void resizeTileBins();
+				void resizeHiZBuffer();
+				// Whether a triangle no nearer than nearestDepth is behind every block of the
+				// Hi-Z buffer overlapping the [minX, maxX] x [minY, maxY] screen rectangle
+				bool isBehindHiZ(float nearestDepth, int minX, int minY, int maxX, int maxY) const;
+
+				// Draws into the visibility buffer instead of the pixel buffer when visibilityId isn't 0
+				void rasterizeTriangle(const Triangle &triangle, uint32_t visibilityId,
+									   int clipMinX, int clipMinY, int clipMaxX, int clipMaxY);
+				void rasterizeTriangleParallel(const Triangle &triangle, uint32_t visibilityId);
+				// Snaps and sets up a triangle clipped to the rectangle, and picks its kernel.
+				// False when nothing is left to draw, or the Hi-Z buffer hides all of it.
+				bool prepareTriangle(const Triangle &triangle, uint32_t visibilityId,
+									 int clipMinX, int clipMinY, int clipMaxX, int clipMaxY, PreparedTriangle &prepared);
+				// Draws the [minY, maxY] rows of a prepared triangle
+				void rasterizePreparedTriangle(const PreparedTriangle &prepared, int minY, int maxY);
+				void resolveVisibilityBuffer();
+				void binTriangles();
+				void drawBinnedTriangles();
+
 				SDL_Texture* m_PixelBufferTexture;
 				std::vector<uint32_t> m_PixelBuffer;
 				std::vector<float> m_DepthBuffer;
 
+				// Hierarchical Z: farthest depth of each BLOCK_SIZE block of the depth
+				// buffer, so that triangles and blocks behind it are rejected without
+				// reading the depth of every pixel.
+				std::vector<float> m_HiZBuffer;
+				int m_HiZWidth;
+				int m_HiZHeight;
+				bool m_HiZEnabled;
+
+				// Deferred shading: ID (index in m_FrameTriangles plus one) of the
+				// triangle visible at each pixel, 0 when there is none
+				std::vector<uint32_t> m_VisibilityBuffer;
+				bool m_VisibilityBufferEnabled;
+
+				bool m_GuardBandEnabled;
+				bool m_FrustumCullingEnabled;
+				bool m_BoundingVolumeHierarchyEnabled;
+				BoundingVolumeHierarchy m_BoundingVolumeHierarchy;
+				// Indices of the meshes that passed the tree query
+				std::vector<size_t> m_VisibleMeshes;
+
+				bool m_OcclusionCullingEnabled;
+				// Farthest depth of the occluders over each pixel, only written
+				// where a pixel is covered whole by an occluder triangle
+				std::vector<float> m_OcclusionBuffer;
+				Math::Vector4Stream m_OccluderVertices;
+
+				// Clip space vertices of each mesh drawn this frame, kept between frames to reuse their memory
+				std::vector<Math::Vector4Stream> m_MeshClipVertices;
+				std::vector<GeometryThread> m_GeometryThreads;
+				// Backs the rest of the transient buffers of a frame: outcodes, view space
+				// vertices, vertex lights and span setups. Reset at the start of render().
+				FrameArena m_FrameArena;
+				// Output of the clipper for the occluders, kept between triangles and frames to reuse its memory
+				std::vector<Triangle> m_ClippedTriangles;
+				ClippingMode m_ClippingMode;
+
+				Math::Matrix4 m_ProjectionMatrix;
+				Clipping m_Clipper;
+
 				int m_PixelBufferWidth;
 				int m_PixelBufferHeight;
 
@@ -91,6 +365,25 @@ namespace Hiruki {
 				bool m_WireframeEnabled;
 				uint32_t m_WireframeColor;
 
+				bool m_DepthTestEnabled;
+				bool m_DepthWriteEnabled;
+
+				RasterKernel m_RasterKernel;
+
+				Stats m_Stats;
+
+				// Binned rasterization: screen-space triangles are collected after the
+				// geometry stage, sorted into TILE_SIZE tiles, and each tile is then
+				// rasterized by a single thread in submission order.
+				bool m_BinningEnabled;
+				int m_TileCountX;
+				int m_TileCountY;
+				// Triangles of tile i are m_TileBinTriangles[m_TileBinStarts[i]] up to
+				// m_TileBinStarts[i + 1], both in the frame arena
+				uint32_t *m_TileBinStarts = nullptr;
+				uint32_t *m_TileBinTriangles = nullptr;
+				// Screen-space triangles of the frame, collected for binned or deferred rendering
+				std::vector<Triangle> m_FrameTriangles;
 		};
 	}
 }
@@ -7,26 +7,25 @@
 #include "math/vector4.hpp"
 #include <array>
 #include <cstdint>
-#include <optional>
+#include <type_traits>
 
 namespace Hiruki {
 	namespace Graphics {
+		// Plain record, trivially copyable, so that the triangles of a frame can be
+		// collected, binned and copied around as raw memory
 		class Triangle {
 		public:
-			Triangle() : texture(std::nullopt), color(0) {};
-
-			~Triangle() {}
+			Triangle() {};
 
 			inline Triangle(const std::array<Math::Vector4, 3> &points)
-						: points(points), color(0xFFFFFFFF), texture(std::nullopt) {}
+						: points(points) {}
 			
 			inline Triangle(const std::array<Math::Vector4, 3> &points, const std::array<TexCoord, 3> &texCoords,
 				   const Texture &texture, std::array<float, 3> vertexLights)
-						: points(points), texCoords(texCoords), texture(texture), color(0xFFFFFFFF),
-						vertexLights(vertexLights) {};
+						: points(points), texCoords(texCoords), vertexLights(vertexLights), texture(&texture) {};
 				
 			inline Triangle(const std::array<Math::Vector4, 3> &points, uint32_t color, std::array<float, 3> vertexLights)
-						: points(points), color(color), texture(std::nullopt), vertexLights(vertexLights) {}
+						: points(points), vertexLights(vertexLights), color(color) {}
 		
 			// Note: Triangles should be in counterclockwise order.
 			inline Math::Vector3 calculateNormal() const {
@@ -51,14 +50,16 @@ namespace Hiruki {
 				}
 			}
 
-			const std::optional<std::reference_wrapper<const Texture>> texture;
-			const uint32_t color;
-
 			std::array<Math::Vector4, 3> points;
 			std::array<TexCoord, 3> texCoords;
 		
-			std::array<float, 3> vertexLights;
+			std::array<float, 3> vertexLights = {};
+			uint32_t color = 0xFFFFFFFF;
+
+			// Null when the triangle is not textured
+			const Texture *texture = nullptr;
 		};
+		static_assert(std::is_trivially_copyable_v<Triangle>);
 	}
 }
 
@@ -0,0 +1,103 @@
+#include "matrix4.hpp"
+#include "vectorStream.hpp"
+#include <cstddef>
+
+#ifdef HIRUKI_MATH_SIMD
+#include <immintrin.h>
+#endif
+
+namespace Hiruki {
+	namespace Math {
+		using TransformKernel = size_t (*)(const Matrix4 &, const Vector3Stream &, Vector4Stream &, size_t);
+
+		// Transforms the points from first onwards, returns the number of points transformed
+		static size_t transformPointsScalar(const Matrix4 &m, const Vector3Stream &points, Vector4Stream &transformed, size_t first) {
+			for(size_t i = first; i < points.size(); i++) {
+				const float x = points.x[i], y = points.y[i], z = points.z[i];
+				transformed.x[i] = x * m[0][0] + y * m[0][1] + z * m[0][2] + m[0][3];
+				transformed.y[i] = x * m[1][0] + y * m[1][1] + z * m[1][2] + m[1][3];
+				transformed.z[i] = x * m[2][0] + y * m[2][1] + z * m[2][2] + m[2][3];
+				transformed.w[i] = x * m[3][0] + y * m[3][1] + z * m[3][2] + m[3][3];
+			}
+			return points.size() - first;
+		}
+
+#ifdef HIRUKI_MATH_SIMD
+		// 4 points per step, leaves the remainder to the scalar kernel.
+		// The streams are aligned to STREAM_ALIGNMENT, so every step uses aligned loads and stores.
+		static size_t transformPointsSSE(const Matrix4 &m, const Vector3Stream &points, Vector4Stream &transformed, size_t first) {
+			const size_t count = (points.size() - first) / 4 * 4;
+
+			__m128 row[4][4];
+			for(int i = 0; i < 4; i++) {
+				for(int j = 0; j < 4; j++) {
+					row[i][j] = _mm_set1_ps(m[i][j]);
+				}
+			}
+
+			float *out[4] = {transformed.x.data(), transformed.y.data(), transformed.z.data(), transformed.w.data()};
+			for(size_t i = first; i < first + count; i += 4) {
+				const __m128 x = _mm_load_ps(points.x.data() + i);
+				const __m128 y = _mm_load_ps(points.y.data() + i);
+				const __m128 z = _mm_load_ps(points.z.data() + i);
+				for(int j = 0; j < 4; j++) {
+					const __m128 value = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, row[j][0]), _mm_mul_ps(y, row[j][1])), _mm_mul_ps(z, row[j][2])), row[j][3]);
+					_mm_store_ps(out[j] + i, value);
+				}
+			}
+			return count;
+		}
+
+		// 8 points per step, only called when the CPU reports AVX2 support. No FMA, so
+		// that the results match the SSE and scalar kernels.
+		__attribute__((target("avx2")))
+		static size_t transformPointsAVX2(const Matrix4 &m, const Vector3Stream &points, Vector4Stream &transformed, size_t first) {
+			const size_t count = (points.size() - first) / 8 * 8;
+
+			__m256 row[4][4];
+			for(int i = 0; i < 4; i++) {
+				for(int j = 0; j < 4; j++) {
+					row[i][j] = _mm256_set1_ps(m[i][j]);
+				}
+			}
+
+			float *out[4] = {transformed.x.data(), transformed.y.data(), transformed.z.data(), transformed.w.data()};
+			for(size_t i = first; i < first + count; i += 8) {
+				const __m256 x = _mm256_load_ps(points.x.data() + i);
+				const __m256 y = _mm256_load_ps(points.y.data() + i);
+				const __m256 z = _mm256_load_ps(points.z.data() + i);
+				for(int j = 0; j < 4; j++) {
+					const __m256 value = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, row[j][0]), _mm256_mul_ps(y, row[j][1])), _mm256_mul_ps(z, row[j][2])), row[j][3]);
+					_mm256_store_ps(out[j] + i, value);
+				}
+			}
+			return count;
+		}
+#endif
+
+		// Widest kernel the CPU is able to run, picked on first use
+		static TransformKernel selectTransformKernel() {
+#ifdef HIRUKI_MATH_SIMD
+			__builtin_cpu_init();
+			if(__builtin_cpu_supports("avx2"))
+				return transformPointsAVX2;
+			return transformPointsSSE;
+#else
+			return transformPointsScalar;
+#endif
+		}
+
+		void Matrix4::transformPoints(const Vector3Stream &points, Vector4Stream &transformed) const {
+			static const TransformKernel kernel = selectTransformKernel();
+
+			transformed.resize(points.size());
+			size_t done = kernel(*this, points, transformed, 0);
+#ifdef HIRUKI_MATH_SIMD
+			// Tail of the AVX2 kernel
+			if(points.size() - done >= 4)
+				done += transformPointsSSE(*this, points, transformed, done);
+#endif
+			transformPointsScalar(*this, points, transformed, done);
+		}
+	}
+}
@@ -3,6 +3,7 @@
 
 #include "math/vector3.hpp"
 #include "math/vector4.hpp"
+#include "math/vectorStream.hpp"
 #include <array>
 #include <cmath>
 
@@ -229,6 +230,10 @@ namespace Hiruki {
 				return newVector;
 			}
 		
+			// Transforms every point (with w = 1) of points into transformed, which is resized to fit.
+			// Processes 4 or 8 points at a time when SSE or AVX2 are available.
+			void transformPoints(const Vector3Stream &points, Vector4Stream &transformed) const;
+		
 			const std::array<float, 4> &operator[](std::size_t index) const {
 				return m[index];
 			}
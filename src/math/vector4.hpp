@@ -10,7 +10,8 @@ namespace Hiruki {
 		class Vector2;
 		class Vector3;
 
-		class Vector4 {
+		// Floats only, and aligned so that a whole vector fits one SSE register
+		class alignas(16) Vector4 {
 		public:
 			inline Vector4 (float x, float y, float z, float w) : x(x), y(y), z(z), w(w) {}
 			inline Vector4 (float x, float y, float z) : x(x), y(y), z(z), w(1) {}
@@ -19,8 +20,7 @@ namespace Hiruki {
 			Vector4 (const Vector2 &that);
 			Vector4 (const Vector3 &that);
 		
-			float x, y, z;
-			double w;
+			float x, y, z, w;
 		
 			static constexpr Vector4 zero() {
 				return Vector4();
@@ -0,0 +1,104 @@
+#ifndef HIRUKI_MATH_VECTOR_STREAM_H
+#define HIRUKI_MATH_VECTOR_STREAM_H
+
+#include "math/vector3.hpp"
+#include "math/vector4.hpp"
+#include <cstddef>
+#include <new>
+#include <vector>
+
+// The batch kernels use SSE/AVX2 intrinsics, so they are only built on x86
+// with compilers that support per-function target attributes.
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__) && defined(__GNUC__)
+#define HIRUKI_MATH_SIMD
+#endif
+
+namespace Hiruki {
+	namespace Math {
+		// Allocates on STREAM_ALIGNMENT boundaries, so that the SIMD kernels can use aligned loads
+		static constexpr size_t STREAM_ALIGNMENT = 32;
+
+		template<typename T>
+		class AlignedAllocator {
+			public:
+				using value_type = T;
+
+				AlignedAllocator() = default;
+				template<typename U>
+				AlignedAllocator(const AlignedAllocator<U> &) {}
+
+				T *allocate(size_t count) {
+					return static_cast<T *>(::operator new(count * sizeof(T), std::align_val_t(STREAM_ALIGNMENT)));
+				}
+
+				void deallocate(T *pointer, size_t) {
+					::operator delete(pointer, std::align_val_t(STREAM_ALIGNMENT));
+				}
+
+				template<typename U>
+				bool operator==(const AlignedAllocator<U> &) const { return true; }
+		};
+
+		using FloatStream = std::vector<float, AlignedAllocator<float>>;
+
+		// Structure of arrays of Vector3s, one array per component
+		class Vector3Stream {
+			public:
+				Vector3Stream() {}
+
+				size_t size() const { return x.size(); }
+				bool empty() const { return x.empty(); }
+
+				void clear() {
+					x.clear();
+					y.clear();
+					z.clear();
+				}
+
+				void resize(size_t size) {
+					x.resize(size);
+					y.resize(size);
+					z.resize(size);
+				}
+
+				void push_back(const Vector3 &vector) {
+					x.push_back(vector.x);
+					y.push_back(vector.y);
+					z.push_back(vector.z);
+				}
+
+				Vector3 operator[](size_t index) const { return Vector3(x[index], y[index], z[index]); }
+
+				FloatStream x, y, z;
+		};
+
+		// Structure of arrays of Vector4s, one array per component
+		class Vector4Stream {
+			public:
+				Vector4Stream() {}
+
+				size_t size() const { return x.size(); }
+				bool empty() const { return x.empty(); }
+
+				void clear() {
+					x.clear();
+					y.clear();
+					z.clear();
+					w.clear();
+				}
+
+				void resize(size_t size) {
+					x.resize(size);
+					y.resize(size);
+					z.resize(size);
+					w.resize(size);
+				}
+
+				Vector4 operator[](size_t index) const { return Vector4(x[index], y[index], z[index], w[index]); }
+
+				FloatStream x, y, z, w;
+		};
+	}
+}
+
+#endif
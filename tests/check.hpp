@@ -0,0 +1,27 @@
+#ifndef HIRUKI_TESTS_CHECK_H
+#define HIRUKI_TESTS_CHECK_H
+
+#include <cstdio>
+
+namespace Hiruki {
+	namespace Tests {
+		// Failed checks so far, main() returns nonzero if there is any
+		inline int failures = 0;
+
+		inline bool check(bool condition, const char *expression, const char *file, int line) {
+			if(!condition) {
+				std::fprintf(stderr, "%s:%d: check failed: %s\n", file, line, expression);
+				failures++;
+			}
+			return condition;
+		}
+
+		void runRenderPathTests();
+		void runClippingTests();
+		void runCullingTests();
+	}
+}
+
+#define CHECK(condition) Hiruki::Tests::check((condition), #condition, __FILE__, __LINE__)
+
+#endif
@@ -0,0 +1,278 @@
+#include "check.hpp"
+#include "graphics/clipping.hpp"
+#include "graphics/triangle.hpp"
+#include "math/matrix4.hpp"
+#include "math/vector2.hpp"
+#include "math/vector4.hpp"
+#include <array>
+#include <cmath>
+#include <cstdio>
+#include <functional>
+#include <vector>
+
+namespace Hiruki {
+	namespace Tests {
+		namespace {
+			using Graphics::Clipping;
+			using Graphics::Triangle;
+
+			constexpr float FOV_Y = 60;
+			constexpr float ASPECT_X = 16.0 / 9.0;
+			constexpr float Z_NEAR = 0.1;
+			constexpr float Z_FAR = 50;
+			constexpr float GUARD_BAND_SCALE = 4;
+			constexpr float EPSILON = 1e-4;
+
+			Clipping makeClipper() {
+				const float fovY = FOV_Y * M_PI / 180.0;
+				const float fovX = std::atan(std::tan(fovY / 2) * ASPECT_X) * 2;
+				return Clipping(Math::Vector2(fovX, fovY), Z_NEAR, Z_FAR, GUARD_BAND_SCALE);
+			}
+
+			// Same projection as the render pipeline, for a 16:9 screen
+			Math::Matrix4 makeProjection() {
+				return Math::Matrix4::perspective(9, 16, FOV_Y, Z_NEAR, Z_FAR);
+			}
+
+			// Each point lights itself with its own x, which must still hold at the
+			// clipped points, as the light is interpolated linearly in clip space
+			Triangle makeTriangle(const std::array<Math::Vector4, 3> &points) {
+				return Triangle(points, 0x12345678, {points[0].x, points[1].x, points[2].x});
+			}
+
+			// Twice the signed area, in the plane of the two given coordinates
+			float signedArea(const Triangle &triangle, int axis0, int axis1) {
+				auto coordinate = [](const Math::Vector4 &point, int axis) {
+					return axis == 0 ? point.x : axis == 1 ? point.y : point.z;
+				};
+				const Math::Vector4 &a = triangle.points[0];
+				const Math::Vector4 &b = triangle.points[1];
+				const Math::Vector4 &c = triangle.points[2];
+				return (coordinate(b, axis0) - coordinate(a, axis0)) * (coordinate(c, axis1) - coordinate(a, axis1)) -
+					   (coordinate(c, axis0) - coordinate(a, axis0)) * (coordinate(b, axis1) - coordinate(a, axis1));
+			}
+
+			// Area of the clipped triangles once projected to the screen
+			float screenArea(const std::vector<Triangle> &triangles) {
+				float area = 0;
+				for(const Triangle &triangle : triangles) {
+					Triangle projected = triangle;
+					for(Math::Vector4 &point : projected.points) {
+						point = point.perspectiveDivide();
+					}
+					area += std::fabs(signedArea(projected, 0, 1));
+				}
+				return area;
+			}
+
+			bool isInsideClipSpace(const Math::Vector4 &point, float sideScale) {
+				const float side = point.w * sideScale + EPSILON;
+				return point.x >= -side && point.x <= side && point.y >= -side && point.y <= side &&
+					   point.z >= -EPSILON && point.z <= point.w + EPSILON;
+			}
+
+			bool isInsideView(const Math::Vector4 &point) {
+				const float fovY = FOV_Y * M_PI / 180.0;
+				const float tanHalfFovY = std::tan(fovY / 2);
+				const float tanHalfFovX = tanHalfFovY * ASPECT_X;
+				const float slack = EPSILON * std::max(1.0f, point.z);
+				return std::fabs(point.x) <= point.z * tanHalfFovX + slack && std::fabs(point.y) <= point.z * tanHalfFovY + slack &&
+					   point.z >= Z_NEAR - slack && point.z <= Z_FAR + slack;
+			}
+
+			// The light and color carried to every clipped point
+			bool hasAttributes(const Triangle &triangle) {
+				for(int i = 0; i < 3; i++) {
+					if(std::fabs(triangle.vertexLights[i] - triangle.points[i].x) > EPSILON * std::max(1.0f, std::fabs(triangle.points[i].x)))
+						return false;
+				}
+				return triangle.color == 0x12345678;
+			}
+
+			bool isSameTriangle(const Triangle &a, const Triangle &b) {
+				for(int i = 0; i < 3; i++) {
+					const Math::Vector4 &p = a.points[i];
+					const Math::Vector4 &q = b.points[i];
+					if(p.x != q.x || p.y != q.y || p.z != q.z || p.w != q.w)
+						return false;
+				}
+				return true;
+			}
+
+			// Clip space plane, as a mapping of the (u, v) plane where u <= 1 is inside
+			class ClipPlane {
+				public:
+					const char *name;
+					uint8_t outcode;
+					std::function<Math::Vector4(float, float)> map;
+					// Coordinates whose plane the mapping is not degenerate in
+					int axis0, axis1;
+			};
+
+			void checkHomogeneousClipping() {
+				const Clipping clipper = makeClipper();
+				std::vector<Triangle> clippedTriangles;
+
+				// Inside every plane, returned as is
+				const Triangle inside = makeTriangle({Math::Vector4(-0.5, -0.5, 0.5, 1), Math::Vector4(0.5, -0.5, 0.5, 1), Math::Vector4(0, 0.5, 0.5, 1)});
+				clipper.clipTriangleHomogeneous(inside, clippedTriangles, false);
+				CHECK(clippedTriangles.size() == 1 && isSameTriangle(clippedTriangles[0], inside));
+
+				// Outside one plane
+				const Triangle outside = makeTriangle({Math::Vector4(1.5, -0.5, 0.5, 1), Math::Vector4(2, -0.5, 0.5, 1), Math::Vector4(1.5, 0.5, 0.5, 1)});
+				clipper.clipTriangleHomogeneous(outside, clippedTriangles, false);
+				CHECK(clippedTriangles.empty());
+				clipper.clipTriangleHomogeneous(outside, clippedTriangles, true);
+				CHECK(clippedTriangles.empty());
+
+				// The (u, v) triangle (0, 0) (2, 0) (0, 2) has an area of 2, 1.5 of which is
+				// at u <= 1, inside the plane. With w = 1 the area is not distorted.
+				const ClipPlane planes[] = {
+					{"left", Clipping::OUTCODE_LEFT, [](float u, float v) { return Math::Vector4(-u, -v * 0.5f, 0.5, 1); }, 0, 1},
+					{"right", Clipping::OUTCODE_RIGHT, [](float u, float v) { return Math::Vector4(u, v * 0.5f, 0.5, 1); }, 0, 1},
+					{"bottom", Clipping::OUTCODE_BOTTOM, [](float u, float v) { return Math::Vector4(v * 0.5f, -u, 0.5, 1); }, 0, 1},
+					{"top", Clipping::OUTCODE_TOP, [](float u, float v) { return Math::Vector4(-v * 0.5f, u, 0.5, 1); }, 0, 1},
+					{"near", Clipping::OUTCODE_NEAR, [](float u, float v) { return Math::Vector4(v * 0.25f, 0, 0.5f - 0.5f * u, 1); }, 0, 2},
+					{"far", Clipping::OUTCODE_FAR, [](float u, float v) { return Math::Vector4(v * 0.25f, 0, 0.5f + 0.5f * u, 1); }, 0, 2},
+				};
+
+				for(const ClipPlane &plane : planes) {
+					std::printf("Homogeneous clipping, %s plane\n", plane.name);
+
+					const Triangle triangle = makeTriangle({plane.map(0, 0), plane.map(2, 0), plane.map(0, 2)});
+					const Triangle inner = makeTriangle({plane.map(0, 0), plane.map(0.9, 0), plane.map(0, 0.9)});
+					const float area = signedArea(triangle, plane.axis0, plane.axis1);
+
+					for(int path = 0; path < 2; path++) {
+						// Both with the outcodes computed by the clipper, and given by the caller
+						if(path == 0) {
+							clipper.clipTriangleHomogeneous(triangle, clippedTriangles, false);
+						} else {
+							clipper.clipTriangleHomogeneous(triangle, plane.outcode, clippedTriangles, false);
+						}
+
+						CHECK(!clippedTriangles.empty() && clippedTriangles.size() <= Clipping::MAX_CLIPPED_TRIANGLES);
+						float clippedArea = 0;
+						for(const Triangle &clippedTriangle : clippedTriangles) {
+							for(const Math::Vector4 &point : clippedTriangle.points) {
+								CHECK(isInsideClipSpace(point, 1));
+							}
+							CHECK(hasAttributes(clippedTriangle));
+							clippedArea += signedArea(clippedTriangle, plane.axis0, plane.axis1);
+						}
+						// The same winding, and a quarter of the area is cut off
+						CHECK(std::fabs(clippedArea - area * 0.75f) <= EPSILON);
+					}
+
+					// Triangles inside the plane are untouched, even when asked to clip against it
+					clipper.clipTriangleHomogeneous(inner, plane.outcode, clippedTriangles, false);
+					if(CHECK(clippedTriangles.size() == 1))
+						CHECK(std::fabs(signedArea(clippedTriangles[0], plane.axis0, plane.axis1) - signedArea(inner, plane.axis0, plane.axis1)) <= EPSILON);
+
+					// Occluder quads, clipped as a whole: the square (0, 0) (2, 2) is cut in half
+					std::array<Math::Vector4, Clipping::MAX_QUAD_POLYGON_VERTICES> quad = {plane.map(0, 0), plane.map(2, 0), plane.map(2, 2), plane.map(0, 2)};
+					const size_t pointCount = Clipping::clipPolygonHomogeneous(quad, 4, plane.outcode);
+					CHECK(pointCount == 4);
+					float quadArea = 0;
+					for(size_t i = 0; i < pointCount; i++) {
+						CHECK(isInsideClipSpace(quad[i], 1));
+						if(i > 0 && i + 1 < pointCount) {
+							quadArea += signedArea(makeTriangle({quad[0], quad[i], quad[i + 1]}), plane.axis0, plane.axis1);
+						}
+					}
+					CHECK(std::fabs(quadArea - area) <= EPSILON);
+				}
+
+				// Sides crossing the view but not the guard band are left to the rasterizer
+				std::printf("Homogeneous clipping, guard band\n");
+				const Triangle wide = makeTriangle({Math::Vector4(-3, -0.5, 0.5, 1), Math::Vector4(3, -0.5, 0.5, 1), Math::Vector4(0, 2, 0.5, 1)});
+				clipper.clipTriangleHomogeneous(wide, clippedTriangles, true);
+				CHECK(clippedTriangles.size() == 1 && isSameTriangle(clippedTriangles[0], wide));
+				clipper.clipTriangleHomogeneous(wide, clippedTriangles, false);
+				CHECK(clippedTriangles.size() > 1);
+
+				// Crossing every plane, and the guard band too
+				const Triangle huge = makeTriangle({Math::Vector4(-20, -10, -1, 1), Math::Vector4(20, -10, 0.5, 1), Math::Vector4(0, 20, 2, 1)});
+				for(bool guardBand : {false, true}) {
+					clipper.clipTriangleHomogeneous(huge, clippedTriangles, guardBand);
+					CHECK(!clippedTriangles.empty() && clippedTriangles.size() <= Clipping::MAX_CLIPPED_TRIANGLES);
+					for(const Triangle &clippedTriangle : clippedTriangles) {
+						for(const Math::Vector4 &point : clippedTriangle.points) {
+							CHECK(isInsideClipSpace(point, guardBand ? GUARD_BAND_SCALE : 1));
+						}
+						CHECK(hasAttributes(clippedTriangle));
+						CHECK(signedArea(clippedTriangle, 0, 1) > 0);
+					}
+				}
+			}
+
+			void checkViewSpaceClipping() {
+				const Clipping clipper = makeClipper();
+				const Math::Matrix4 projectionMatrix = makeProjection();
+				std::vector<Triangle> clippedTriangles, homogeneousTriangles;
+
+				// Counter-clockwise seen from the camera, crossing each plane of the view
+				const std::array<Math::Vector4, 3> crossing[] = {
+					{Math::Vector4(-8, -0.5, 4, 1), Math::Vector4(0, -0.5, 4, 1), Math::Vector4(-1, 0.5, 4, 1)}, // Left
+					{Math::Vector4(0, -0.5, 4, 1), Math::Vector4(8, -0.5, 4, 1), Math::Vector4(1, 0.5, 4, 1)}, // Right
+					{Math::Vector4(-0.5, -5, 4, 1), Math::Vector4(0.5, -5, 4, 1), Math::Vector4(0, 0.5, 4, 1)}, // Bottom
+					{Math::Vector4(-0.5, 0, 4, 1), Math::Vector4(0.5, 0, 4, 1), Math::Vector4(0, 5, 4, 1)}, // Top
+					{Math::Vector4(-0.5, -0.5, -1, 1), Math::Vector4(0.5, -0.5, 2, 1), Math::Vector4(0, 0.5, 2, 1)}, // Near
+					{Math::Vector4(-0.5, -0.5, 40, 1), Math::Vector4(0.5, -0.5, 60, 1), Math::Vector4(0, 0.5, 40, 1)}, // Far
+				};
+
+				std::printf("View space clipping\n");
+				for(const std::array<Math::Vector4, 3> &points : crossing) {
+					const Triangle triangle = makeTriangle(points);
+					clipper.clipTriangle(triangle, clippedTriangles, false);
+
+					CHECK(!clippedTriangles.empty() && clippedTriangles.size() <= Clipping::MAX_CLIPPED_TRIANGLES);
+					for(const Triangle &clippedTriangle : clippedTriangles) {
+						for(const Math::Vector4 &point : clippedTriangle.points) {
+							CHECK(isInsideView(point));
+						}
+						CHECK(hasAttributes(clippedTriangle));
+					}
+
+					// Both clippers keep the same part of the triangle, once projected
+					for(Triangle &clippedTriangle : clippedTriangles) {
+						for(Math::Vector4 &point : clippedTriangle.points) {
+							point = projectionMatrix.mul(point);
+						}
+					}
+					Triangle projected = triangle;
+					for(Math::Vector4 &point : projected.points) {
+						point = projectionMatrix.mul(point);
+					}
+					clipper.clipTriangleHomogeneous(projected, homogeneousTriangles, false);
+
+					const float area = screenArea(clippedTriangles);
+					const float homogeneousArea = screenArea(homogeneousTriangles);
+					CHECK(area > 0);
+					if(!CHECK(std::fabs(area - homogeneousArea) <= 1e-3 * std::max(area, homogeneousArea)))
+						std::fprintf(stderr, "  screen areas %f and %f\n", area, homogeneousArea);
+				}
+
+				// With a guard band, only near and far are clipped against, inside its sides
+				const Triangle inside = makeTriangle({Math::Vector4(-0.5, -0.5, 4, 1), Math::Vector4(0.5, -0.5, 4, 1), Math::Vector4(0, 0.5, 4, 1)});
+				clipper.clipTriangle(inside, clippedTriangles, true);
+				CHECK(clippedTriangles.size() == 1 && isSameTriangle(clippedTriangles[0], inside));
+
+				const Triangle wide = makeTriangle(crossing[1]);
+				clipper.clipTriangle(wide, clippedTriangles, true);
+				CHECK(clippedTriangles.size() == 1 && isSameTriangle(clippedTriangles[0], wide));
+
+				const Triangle outside = makeTriangle({Math::Vector4(-0.5, -0.5, -2, 1), Math::Vector4(0.5, -0.5, -2, 1), Math::Vector4(0, 0.5, -2, 1)});
+				for(bool guardBand : {false, true}) {
+					clipper.clipTriangle(outside, clippedTriangles, guardBand);
+					CHECK(clippedTriangles.empty());
+				}
+			}
+		}
+
+		void runClippingTests() {
+			checkHomogeneousClipping();
+			checkViewSpaceClipping();
+		}
+	}
+}
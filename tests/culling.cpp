@@ -0,0 +1,195 @@
+#include "check.hpp"
+#include "graphics/boundingVolumeHierarchy.hpp"
+#include "graphics/mesh.hpp"
+#include "graphics/renderPipeline.hpp"
+#include "math/matrix4.hpp"
+#include "math/vector4.hpp"
+#include "scene.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <omp.h>
+#include <vector>
+
+namespace Hiruki {
+	namespace Tests {
+		namespace {
+			using Graphics::BoundingVolumeHierarchy;
+			using Graphics::Mesh;
+			using Graphics::RenderPipeline;
+
+			constexpr int WIDTH = 160;
+			constexpr int HEIGHT = 90;
+
+			Mesh makeCube(Math::Vector3 translation, Math::Vector3 scale = Math::Vector3::one()) {
+				Mesh mesh = Mesh::defaultCube();
+				mesh.translation = translation;
+				mesh.scale = scale;
+				return mesh;
+			}
+
+			// Same view and projection as the render pipeline, from the origin along +z
+			Math::Matrix4 makeViewProjection(const Scene::Camera &camera) {
+				const Math::Matrix4 projectionMatrix = Math::Matrix4::perspective(HEIGHT, WIDTH, 60, 0.1, 50);
+				return projectionMatrix.mul(Math::Matrix4::lookAt(camera.getPosition(), camera.getTarget(), camera.getUp()));
+			}
+
+			// Whether a point is strictly inside the view
+			bool isInView(const Math::Matrix4 &viewProjectionMatrix, const Math::Vector3 &point) {
+				const Math::Vector4 clipPoint = viewProjectionMatrix.mul(Math::Vector4(point.x, point.y, point.z, 1));
+				return clipPoint.w > 0 && clipPoint.z > 0 && clipPoint.z < clipPoint.w &&
+					   std::fabs(clipPoint.x) < clipPoint.w && std::fabs(clipPoint.y) < clipPoint.w;
+			}
+
+			std::vector<std::reference_wrapper<const Mesh>> references(const std::vector<Mesh> &meshes) {
+				return std::vector<std::reference_wrapper<const Mesh>>(meshes.begin(), meshes.end());
+			}
+
+			void checkBoundingVolumeHierarchy() {
+				std::printf("Bounding volume hierarchy\n");
+
+				const Scene::Camera camera;
+				const Math::Matrix4 viewProjectionMatrix = makeViewProjection(camera);
+				BoundingVolumeHierarchy hierarchy;
+				std::vector<size_t> visibleMeshes;
+
+				std::vector<Mesh> meshes = {
+					makeCube({0, 0, 5}), // In front
+					makeCube({0, 0, -5}), // Behind
+					makeCube({-50, 0, 5}), // Far to the left
+					makeCube({0, 0, -5}), // Behind, without bounds
+				};
+				meshes[3].boundingSphereRadius = -1;
+
+				std::vector<std::reference_wrapper<const Mesh>> submitted = references(meshes);
+				// The same mesh twice
+				submitted.push_back(meshes[0]);
+
+				hierarchy.update(submitted);
+				CHECK(hierarchy.size() == 3);
+				hierarchy.queryVisible(viewProjectionMatrix, visibleMeshes);
+				CHECK((visibleMeshes == std::vector<size_t>{0, 3, 4}));
+
+				// Moved in front, and moved behind. Repeated submissions always pass the query.
+				meshes[1].translation = {1, 1, 8};
+				meshes[0].translation = {0, 0, -20};
+				hierarchy.update(submitted);
+				hierarchy.queryVisible(viewProjectionMatrix, visibleMeshes);
+				CHECK((visibleMeshes == std::vector<size_t>{1, 3, 4}));
+
+				// Meshes no longer submitted are removed, the indices are the ones of the last update
+				hierarchy.update({meshes[2], meshes[1]});
+				CHECK(hierarchy.size() == 2);
+				hierarchy.queryVisible(viewProjectionMatrix, visibleMeshes);
+				CHECK((visibleMeshes == std::vector<size_t>{1}));
+
+				// Only meshes without bounds, so no tree at all
+				hierarchy.update({meshes[3]});
+				CHECK(hierarchy.size() == 0);
+				hierarchy.queryVisible(viewProjectionMatrix, visibleMeshes);
+				CHECK((visibleMeshes == std::vector<size_t>{0}));
+
+				// A grid of small meshes around the camera. Boxes are only tested against the planes,
+				// so some meshes outside the view may be returned, but never one with its center in it.
+				std::vector<Mesh> grid;
+				for(int z = -20; z < 20; z++) {
+					for(int x = -20; x < 20; x++) {
+						grid.push_back(makeCube({x * 2.5f, (x + z) % 3 * 0.5f, z * 2.5f}, {0.2, 0.2, 0.2}));
+					}
+				}
+
+				hierarchy.update(references(grid));
+				CHECK(hierarchy.size() == grid.size());
+				hierarchy.queryVisible(viewProjectionMatrix, visibleMeshes);
+				CHECK(std::is_sorted(visibleMeshes.begin(), visibleMeshes.end()));
+				CHECK(std::adjacent_find(visibleMeshes.begin(), visibleMeshes.end()) == visibleMeshes.end());
+
+				size_t inView = 0;
+				for(size_t i = 0; i < grid.size(); i++) {
+					const bool visible = std::binary_search(visibleMeshes.begin(), visibleMeshes.end(), i);
+					if(isInView(viewProjectionMatrix, grid[i].translation)) {
+						inView++;
+						CHECK(visible);
+					}
+					// Well behind the camera
+					if(grid[i].translation.z < -2) {
+						CHECK(!visible);
+					}
+				}
+				CHECK(inView > 0);
+				CHECK(visibleMeshes.size() < grid.size() / 2);
+			}
+
+			RenderPipeline::Stats renderStats(const std::vector<Mesh> &meshes, const Scene::Camera &camera, bool hierarchy) {
+				RenderPipeline renderPipeline(WIDTH, HEIGHT, nullptr);
+				renderPipeline.setDrawMode(RenderPipeline::DrawMode::SOLID);
+				renderPipeline.setBoundingVolumeHierarchyEnabled(hierarchy);
+
+				omp_set_num_threads(1);
+				renderPipeline.render(references(meshes), camera, 1, Math::Vector3::forward());
+				return renderPipeline.getStats();
+			}
+
+			void checkOcclusionCulling() {
+				std::printf("Occlusion culling\n");
+
+				Scene::Camera camera;
+				Mesh wall = makeCube({0, 0, 5}, {3, 3, 0.2});
+				wall.occluder = true;
+
+				for(bool hierarchy : {false, true}) {
+					// Behind the middle of the wall, across the diagonals of its faces
+					CHECK(renderStats({wall, makeCube({0, 0, 10})}, camera, hierarchy).occludedMeshes == 1);
+					// Also behind the wall, but without bounds to test
+					Mesh unbounded = makeCube({0, 0, 10});
+					unbounded.boundingSphereRadius = -1;
+					CHECK(renderStats({wall, unbounded}, camera, hierarchy).occludedMeshes == 0);
+					// In front of the wall, beside it, and peeking out from behind its side
+					CHECK(renderStats({wall, makeCube({0, 0, 2}, {0.5, 0.5, 0.5})}, camera, hierarchy).occludedMeshes == 0);
+					CHECK(renderStats({wall, makeCube({9, 0, 10})}, camera, hierarchy).occludedMeshes == 0);
+					CHECK(renderStats({wall, makeCube({6, 0, 10})}, camera, hierarchy).occludedMeshes == 0);
+
+					// The wall is not an occluder
+					Mesh plainWall = wall;
+					plainWall.occluder = false;
+					CHECK(renderStats({plainWall, makeCube({0, 0, 10})}, camera, hierarchy).occludedMeshes == 0);
+				}
+
+				// A floor crossing the near plane and the sides of the view, which is clipped
+				// before being drawn into the occlusion buffer
+				Scene::Camera above;
+				above.setPosition({0, 1, 0});
+				above.setTarget({0, 0, 5});
+				Mesh floor = makeCube({0, -1, 0}, {40, 0.1, 40});
+				floor.occluder = true;
+				CHECK(renderStats({floor, makeCube({0, -4, 8})}, above, false).occludedMeshes == 1);
+				CHECK(renderStats({floor, makeCube({0, 0, 8}, {0.5, 0.5, 0.5})}, above, false).occludedMeshes == 0);
+			}
+
+			void checkFrustumCulling() {
+				std::printf("Frustum culling\n");
+
+				const Scene::Camera camera;
+				Mesh unbounded = makeCube({0, 0, -10});
+				unbounded.boundingSphereRadius = -1;
+				const std::vector<Mesh> meshes = {
+					makeCube({0, 0, 10}),
+					makeCube({0, 0, -10}),
+					makeCube({30, 0, 10}),
+					makeCube({0, 0, 100}),
+					unbounded,
+				};
+
+				for(bool hierarchy : {false, true}) {
+					const RenderPipeline::Stats stats = renderStats(meshes, camera, hierarchy);
+					CHECK(stats.culledMeshes == 3);
+				}
+			}
+		}
+
+		void runCullingTests() {
+			checkBoundingVolumeHierarchy();
+			checkOcclusionCulling();
+			checkFrustumCulling();
+		}
+	}
+}
@@ -0,0 +1,16 @@
+#include "check.hpp"
+#include <cstdio>
+
+int main() {
+	Hiruki::Tests::runRenderPathTests();
+	Hiruki::Tests::runClippingTests();
+	Hiruki::Tests::runCullingTests();
+
+	if(Hiruki::Tests::failures > 0) {
+		std::fprintf(stderr, "%d checks failed\n", Hiruki::Tests::failures);
+		return 1;
+	}
+
+	std::printf("All checks passed\n");
+	return 0;
+}
@@ -0,0 +1,205 @@
+#include "check.hpp"
+#include "graphics/mesh.hpp"
+#include "graphics/renderPipeline.hpp"
+#include "scene.hpp"
+#include <cstdio>
+#include <functional>
+#include <omp.h>
+#include <vector>
+
+namespace Hiruki {
+	namespace Tests {
+		namespace {
+			using Graphics::Mesh;
+			using Graphics::RenderPipeline;
+
+			// Odd, so that the screen is not made of whole tiles nor blocks
+			constexpr int WIDTH = 203;
+			constexpr int HEIGHT = 117;
+
+			class Frame {
+				public:
+					std::vector<uint32_t> pixels;
+					RenderPipeline::Stats stats;
+			};
+
+			class RenderCase {
+				public:
+					const char *name;
+					RenderPipeline::DrawMode drawMode;
+					RenderPipeline::ShadingMode shadingMode;
+					bool wireframe;
+			};
+
+			// Cubes crossing the near plane and the sides of the screen, overlapping in depth,
+			// and one hidden behind an occluder
+			std::vector<Mesh> buildScene() {
+				std::vector<Mesh> meshes;
+				auto addCube = [&](Math::Vector3 translation, Math::Vector3 scale, Math::Vector3 rotation) -> Mesh & {
+					Mesh &mesh = meshes.emplace_back(Mesh::defaultCube());
+					mesh.translation = translation;
+					mesh.scale = scale;
+					mesh.rotation = rotation;
+					return mesh;
+				};
+
+				addCube({0, 0, 5}, {1, 1, 1}, {30, 45, 0});
+				addCube({1.5, -0.3, -0.2}, {1, 1, 1}, {0, 10, 0}); // Crosses the near plane
+				addCube({4, 1, 6}, {1, 1.5, 1}, {0, 20, 15}); // Crosses the right side
+				addCube({-3.5, -1.8, 5}, {1, 1, 1}, {10, 0, 40}); // Crosses the left and bottom sides
+				addCube({0.5, 0.5, 20}, {8, 8, 1}, {0, 0, 5}); // Background, behind the others
+				addCube({-2, 0.5, 8}, {1.5, 1.5, 0.2}, {}).occluder = true;
+				addCube({-2, 0.5, 12}, {0.5, 0.5, 0.5}, {0, 30, 0}); // Hidden behind the occluder
+
+				return meshes;
+			}
+
+			// Renders the scene twice, so that the second frame uses the cached world space
+			// vertices and the frame arena left by the first one, and checks both frames are the same
+			Frame renderScene(const std::vector<Mesh> &scene, const RenderCase &renderCase, int numThreads,
+							  const std::function<void(RenderPipeline &)> &configure) {
+				RenderPipeline renderPipeline(WIDTH, HEIGHT, nullptr);
+				renderPipeline.setDrawMode(renderCase.drawMode);
+				renderPipeline.setShadingMode(renderCase.shadingMode);
+				renderPipeline.setWireframeEnabled(renderCase.wireframe);
+				renderPipeline.setRasterKernel(RenderPipeline::RasterKernel::SCALAR);
+				renderPipeline.setBinningEnabled(false);
+				configure(renderPipeline);
+
+				std::vector<std::reference_wrapper<const Mesh>> meshes(scene.begin(), scene.end());
+				Scene::Camera camera;
+				camera.setPosition({0, 0, -1});
+				camera.setTarget({0, 0, 5});
+				const Math::Vector3 lightDirection = Math::Vector3(0.3, -0.5, 1).normalized();
+
+				omp_set_num_threads(numThreads);
+				renderPipeline.render(meshes, camera, numThreads, lightDirection);
+				Frame frame = {renderPipeline.getPixelBuffer(), renderPipeline.getStats()};
+
+				renderPipeline.render(meshes, camera, numThreads, lightDirection);
+				CHECK(renderPipeline.getPixelBuffer() == frame.pixels);
+				CHECK(frame.stats.frameArenaBytes > 0);
+				CHECK(renderPipeline.getStats().frameArenaBytes == frame.stats.frameArenaBytes);
+
+				return frame;
+			}
+
+			size_t countDifferentPixels(const std::vector<uint32_t> &a, const std::vector<uint32_t> &b) {
+				size_t count = 0;
+				for(size_t i = 0; i < a.size(); i++) {
+					if(a[i] != b[i])
+						count++;
+				}
+				return count;
+			}
+
+			// Pixels drawn in one picture and not in the other
+			size_t countDifferentCoverage(const std::vector<uint32_t> &a, const std::vector<uint32_t> &b) {
+				size_t count = 0;
+				for(size_t i = 0; i < a.size(); i++) {
+					if((a[i] != 0) != (b[i] != 0))
+						count++;
+				}
+				return count;
+			}
+
+			size_t countDrawnPixels(const std::vector<uint32_t> &pixels) {
+				size_t count = 0;
+				for(uint32_t pixel : pixels) {
+					if(pixel != 0)
+						count++;
+				}
+				return count;
+			}
+		}
+
+		void runRenderPathTests() {
+			const std::vector<Mesh> scene = buildScene();
+			const RenderCase renderCases[] = {
+				{"solid", RenderPipeline::DrawMode::SOLID, RenderPipeline::ShadingMode::NONE, false},
+				{"solid flat", RenderPipeline::DrawMode::SOLID, RenderPipeline::ShadingMode::FLAT, false},
+				{"gradient goraud", RenderPipeline::DrawMode::GRADIENT, RenderPipeline::ShadingMode::GORAUD, false},
+				{"solid wireframe", RenderPipeline::DrawMode::SOLID, RenderPipeline::ShadingMode::FLAT, true},
+			};
+
+			for(const RenderCase &renderCase : renderCases) {
+				std::printf("Render paths, %s\n", renderCase.name);
+
+				// Scalar kernel, forward shading, on one thread
+				const Frame reference = renderScene(scene, renderCase, 1, [](RenderPipeline &) {});
+				CHECK(countDrawnPixels(reference.pixels) > WIDTH * HEIGHT / 2);
+				CHECK(reference.stats.clippedTriangles > 0);
+
+				// Each of these draws the same pixels, in a different way
+				auto checkSame = [&](const char *path, int numThreads, const std::function<void(RenderPipeline &)> &configure) {
+					const Frame frame = renderScene(scene, renderCase, numThreads, configure);
+					if(!CHECK(frame.pixels == reference.pixels))
+						std::fprintf(stderr, "  %s: %zu different pixels\n", path, countDifferentPixels(frame.pixels, reference.pixels));
+				};
+
+				if(RenderPipeline::isRasterKernelSupported(RenderPipeline::RasterKernel::SSE)) {
+					checkSame("sse", 1, [](RenderPipeline &renderPipeline) {
+						renderPipeline.setRasterKernel(RenderPipeline::RasterKernel::SSE);
+					});
+				}
+				if(RenderPipeline::isRasterKernelSupported(RenderPipeline::RasterKernel::AVX2)) {
+					checkSame("avx2", 1, [](RenderPipeline &renderPipeline) {
+						renderPipeline.setRasterKernel(RenderPipeline::RasterKernel::AVX2);
+					});
+				}
+				checkSame("parallel", 4, [](RenderPipeline &) {});
+				checkSame("binned", 4, [](RenderPipeline &renderPipeline) {
+					renderPipeline.setBinningEnabled(true);
+				});
+				checkSame("deferred", 1, [](RenderPipeline &renderPipeline) {
+					renderPipeline.setVisibilityBufferEnabled(true);
+				});
+				checkSame("deferred binned", 4, [](RenderPipeline &renderPipeline) {
+					renderPipeline.setVisibilityBufferEnabled(true);
+					renderPipeline.setBinningEnabled(true);
+				});
+				checkSame("no hi-z", 1, [](RenderPipeline &renderPipeline) {
+					renderPipeline.setHiZEnabled(false);
+				});
+				checkSame("no frustum culling", 1, [](RenderPipeline &renderPipeline) {
+					renderPipeline.setFrustumCullingEnabled(false);
+				});
+				checkSame("bvh", 1, [](RenderPipeline &renderPipeline) {
+					renderPipeline.setBoundingVolumeHierarchyEnabled(true);
+				});
+
+				// The cube behind the occluder is skipped, without changing the picture
+				const Frame unoccluded = renderScene(scene, renderCase, 1, [](RenderPipeline &renderPipeline) {
+					renderPipeline.setOcclusionCullingEnabled(false);
+				});
+				CHECK(unoccluded.pixels == reference.pixels);
+				CHECK(unoccluded.stats.occludedMeshes == 0);
+				CHECK(reference.stats.occludedMeshes == 1);
+
+				// Clipping in other planes or spaces moves the edges at the clipped vertices by a
+				// rounding error, so only a few pixels along them may differ. Gradients are
+				// interpolated across each clipped triangle, so only their coverage is compared,
+				// and the wireframe outlines the clipped triangles, so it is not compared.
+				if(renderCase.wireframe)
+					continue;
+
+				const bool gradient = renderCase.drawMode == RenderPipeline::DrawMode::GRADIENT;
+				const size_t maxDifferentPixels = WIDTH * HEIGHT / 500;
+				auto checkClose = [&](const char *path, const std::function<void(RenderPipeline &)> &configure) {
+					const Frame frame = renderScene(scene, renderCase, 1, configure);
+					const size_t differentPixels = gradient ? countDifferentCoverage(frame.pixels, reference.pixels)
+															: countDifferentPixels(frame.pixels, reference.pixels);
+					if(!CHECK(differentPixels <= maxDifferentPixels))
+						std::fprintf(stderr, "  %s: %zu different pixels\n", path, differentPixels);
+				};
+
+				checkClose("no guard band", [](RenderPipeline &renderPipeline) {
+					renderPipeline.setGuardBandEnabled(false);
+				});
+				checkClose("view space clipping", [](RenderPipeline &renderPipeline) {
+					renderPipeline.setClippingMode(RenderPipeline::ClippingMode::VIEW_SPACE);
+				});
+			}
+		}
+	}
+}